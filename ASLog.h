@@ -82,12 +82,66 @@
  2015-04-08 - 	Added simple call-through to main logging function without file 
  				or line number info for the standard logging methods. Also 
  				defined accompanying macro.
+ 2026-10-18 -	Added ASLogHex() and ASLogData() to log binary data as a hex dump
+ 				without going through -description.
+ 2026-10-18 -	Added ASLogPayload() to log a caller owned buffer after a formatted
+ 				prefix without copying it into an NSString.
+ 2026-10-18 -	Log messages are formatted into a bounded per-thread buffer and 
+ 				cut short at a configurable length, see +setMaxRecordLength:
+ 2026-10-18 -	Added ASWarnTrace() and ASFnWarnTrace(), and +setWarnBacktraceOn:,
+ 				to log raw backtraces with warnings for offline symbolization.
+ 2026-10-18 -	Call sites logging faster than a configurable rate are throttled
+ 				automatically, see +setSiteRateLimit:
+ 2026-10-18 -	Debug then normal lines are shed while output is slow, see
+ 				+setShedLatency:
+ 2026-10-18 -	Added asynchronous output with a separate lane for warnings, see
+ 				+setAsyncOn:
+ 2026-10-18 -	The asynchronous writer thread can be pinned, deprioritized and 
+ 				given a wakeup strategy, see +setWriterWakeup:interval:
+ 2026-10-18 -	Asynchronous output survives fork(), the child gets its own writer 
+ 				thread.
+ 2026-10-18 -	Asynchronous queues can be per NUMA node and use huge pages, see 
+ 				+setAsyncNUMAOn: and +setAsyncHugePagesOn:
+ 2026-10-18 -	Lines too big for the asynchronous queue are queued in per-thread 
+ 				record pools, see +setAsyncPoolBudget:
+ 2026-10-18 -	Added an overall memory budget and +memoryReport, see 
+ 				+setMemoryBudget:
+ 2026-10-18 -	Added a fixed size circular log file, see 
+ 				+switchLoggingToCircularFile:capacity: and Tools/aslog-cat
+ 2026-10-18 -	stderr is redirected and restored by descriptor with dup2(), which
+ 				also works on Linux and for pipes and sockets. Added nesting
+ 				+pushLogDestination: and +popLogDestination
+ 2026-10-18 -	Added Tools/aslog-tail.c to follow a log with filters
+ 2026-10-18 -	The layout of log lines is set by a pattern compiled once, see
+ 				+setPrefixPattern:
+ 2026-10-18 -	Added +setNSLogHeaderOn: to write NSLog()'s header without the 
+ 				cost of NSLog()
+ 2026-10-18 -	String literal formats are parsed once and the parse cached
+ 2026-10-18 -	Added ASLogLazy() and ASDLogLazy() to log the result of a block 
+ 				only run if the line is logged, optionally on the writer thread
+ 2026-10-18 -	Objects can write themselves into log messages without 
+ 				-description, see ASLogFormattable and +registerFormatter:forClass:
+ 2026-10-18 -	Asynchronous mode can leave -description of immutable %@ arguments
+ 				to the writer thread, see +setAsyncDeferDescriptionsOn:
+ 2026-10-18 -	C11 logging macros for plain C modules in ASLogC.h, their arguments
+ 				are typed when compiled and formatted by the writer thread
+ 2026-10-18 -	Asynchronous lines can be staged per thread and queued in chunks,
+ 				see +setAsyncStagingOn:interval:
+ 2026-10-18 -	Output can be copied to extra sinks, each with its own queue and
+ 				writer thread so a slow one drops lines rather than stalling the 
+ 				others, see +addLogSink:queueSize:
+ 2026-10-18 -	On Linux sinks that are pipes can be fed with vmsplice(), without 
+ 				copying the bytes into the kernel, see 
+ 				+addLogSink:queueSize:splicing:
  
  */
 
 #import <Foundation/NSDebug.h>
 #import <Cocoa/Cocoa.h>
 
+// ASLogLevel and the C logging macros
+#import "ASLogC.h"
+
 
 
 #pragma mark Macro defintions
@@ -97,6 +151,47 @@
  */
 #define ASLogVersion "1.0.1"
 
+#pragma mark Types
+
+/*! \struct ASLogBuffer
+ @brief A log message being built, opaque, written to with the ASLogAppend...() 
+ functions
+ */
+typedef struct ASLogBuffer ASLogBuffer;
+
+/*! \typedef ASLogFormatter
+ @brief Function that appends an object to a log message in place of -description,
+ see +registerFormatter:forClass:
+ */
+typedef void (*ASLogFormatter)(id object, ASLogBuffer *buffer);
+
+/*! \enum ASLogHexStyle
+ @brief Layout used by the hex dump macros
+ */
+typedef enum {
+	ASLogHexStyleDump = 0,	//!< Classic offset/hex/ASCII dump, 16 bytes per line
+	ASLogHexStyleCompact	//!< A single unbroken run of hex digits
+} ASLogHexStyle;
+
+/*! \enum ASLogWriterWakeup
+ @brief How the asynchronous writer thread waits for work
+ */
+typedef enum {
+	ASLogWriterWakeupBlock = 0,		//!< Sleep until a line is queued
+	ASLogWriterWakeupSpin,			//!< Never sleep, poll the queue
+	ASLogWriterWakeupSpinThenBlock,	//!< Poll for an interval, then sleep until a line is queued
+	ASLogWriterWakeupInterval		//!< Wake every interval to write in batches, warnings wake it early
+} ASLogWriterWakeup;
+
+/*! \enum ASLogPoolFull
+ @brief What happens to a line too big for the asynchronous queue once the record 
+ pools are out of budget
+ */
+typedef enum {
+	ASLogPoolFullWrite = 0,		//!< Write it straight away on the calling thread
+	ASLogPoolFullDrop			//!< Drop it and count it, warnings are still written
+} ASLogPoolFull;
+
 /*!
  \name Debug Logging macros. 
  @relates ASLog
@@ -210,8 +305,92 @@
  */
 #define ASFnWarn(s, ...) do { [ASLog warn:__FILE__ lineNumber:__LINE__ function:(char*)__FUNCTION__ format:(s),##__VA_ARGS__]; } while (0)
 
+/*! \def ASWarnTrace
+ @brief NSLog + "WARNING" + logs the sourcefile and line number + raw backtrace
+ */
+#define ASWarnTrace(s, ...) do { [ASLog warnTrace:__FILE__ lineNumber:__LINE__ format:(s),##__VA_ARGS__]; } while (0)
+
+/*! \def ASFnWarnTrace
+ @brief NSLog + "WARNING" + logs the sourcefile and line number and calling method + raw backtrace
+ */
+#define ASFnWarnTrace(s, ...) do { [ASLog warnTrace:__FILE__ lineNumber:__LINE__ function:(char*)__FUNCTION__ format:(s),##__VA_ARGS__]; } while (0)
+
 //@} (Warning Logging macros)
 
+
+/*!
+ \name Binary Logging macros.
+ @relates ASLog
+ 
+ Convenience interface to ASLog hex dump methods
+ 
+ - Log raw bytes as hex without going through -description.
+ - Take an ASLogLevel; ASLogLevelDebug lines only fire when debug logging is on.
+ - Not compiled out in release builds.
+ - Output is truncated to the limit set with +setHexLimit:
+ */
+//@{
+
+/*! \def ASLogHex
+ @brief Hex dump of len bytes at ptr + logs the sourcefile and line number
+ */
+#define ASLogHex(level, ptr, len) do { [ASLog hexLog:__FILE__ lineNumber:__LINE__ level:(level) bytes:(ptr) length:(len)]; } while (0)
+
+/*! \def ASLogData
+ @brief Hex dump of the contents of an NSData + logs the sourcefile and line number
+ */
+#define ASLogData(level, data) do { [ASLog hexLog:__FILE__ lineNumber:__LINE__ level:(level) data:(data)]; } while (0)
+
+/*! \def ASLogPayload
+ @brief Formatted prefix followed by len bytes of text at ptr + logs the sourcefile and line number
+ */
+#define ASLogPayload(level, ptr, len, s, ...) do { [ASLog payloadLog:__FILE__ lineNumber:__LINE__ level:(level) bytes:(ptr) length:(len) format:(s),##__VA_ARGS__]; } while (0)
+
+//@} (Binary Logging macros)
+
+
+#if defined(__BLOCKS__)
+/*!
+ \name Lazy Logging macros.
+ @relates ASLog
+ 
+ Convenience interface to the ASLog deferred logging method
+ 
+ - Take a block returning the NSString to log, e.g. ASDLogLazy(^NSString *{ return [graph dump]; })
+ - The block only runs if the line is logged.
+ - The OnWriter forms run the block on the writer thread in asynchronous mode, it 
+   should only use values nothing else changes.
+ - Only available where the compiler supports blocks.
+ */
+//@{
+
+	/*! \def ASDLogLazy
+	 @brief Logs what the block returns + the sourcefile and line number, compiled out in release builds
+	 
+	 \def ASDLogLazyOnWriter
+	 @brief As #ASDLogLazy, the block runs on the asynchronous writer thread
+	 */
+#ifdef BUILD_WITH_DEBUG_LOGGING
+	#define ASDLogLazy(block) do { [ASLog lazyLog:__FILE__ lineNumber:__LINE__ level:ASLogLevelDebug onWriter:NO block:(block)]; } while (0)
+	#define ASDLogLazyOnWriter(block) do { [ASLog lazyLog:__FILE__ lineNumber:__LINE__ level:ASLogLevelDebug onWriter:YES block:(block)]; } while (0)
+#else
+	#define ASDLogLazy(block) do { (void)sizeof(block); } while (0)
+	#define ASDLogLazyOnWriter(block) do { (void)sizeof(block); } while (0)
+#endif
+
+/*! \def ASLogLazy
+ @brief Logs what the block returns at level + the sourcefile and line number
+ */
+#define ASLogLazy(level, block) do { [ASLog lazyLog:__FILE__ lineNumber:__LINE__ level:(level) onWriter:NO block:(block)]; } while (0)
+
+/*! \def ASLogLazyOnWriter
+ @brief As #ASLogLazy, the block runs on the asynchronous writer thread
+ */
+#define ASLogLazyOnWriter(level, block) do { [ASLog lazyLog:__FILE__ lineNumber:__LINE__ level:(level) onWriter:YES block:(block)]; } while (0)
+
+//@} (Lazy Logging macros)
+#endif
+
 #pragma mark Prototypes
 
 /*! \fn QuietLog (NSString *format, ...)
@@ -219,6 +398,62 @@
  */
 extern void QuietLog (NSString *format, ...);
 
+/*! \fn ASLogAppendBytes (ASLogBuffer *buffer, const char *bytes, size_t length)
+ @brief Appends UTF-8 text to a log message
+ */
+extern void ASLogAppendBytes (ASLogBuffer *buffer, const char *bytes, size_t length);
+
+/*! \fn ASLogAppendCString (ASLogBuffer *buffer, const char *string)
+ @brief Appends a c-string to a log message
+ */
+extern void ASLogAppendCString (ASLogBuffer *buffer, const char *string);
+
+/*! \fn ASLogAppendString (ASLogBuffer *buffer, NSString *string)
+ @brief Appends an NSString to a log message
+ */
+extern void ASLogAppendString (ASLogBuffer *buffer, NSString *string);
+
+/*! \fn ASLogAppendInteger (ASLogBuffer *buffer, long long value)
+ @brief Appends a signed number to a log message
+ */
+extern void ASLogAppendInteger (ASLogBuffer *buffer, long long value);
+
+/*! \fn ASLogAppendUnsigned (ASLogBuffer *buffer, unsigned long long value)
+ @brief Appends an unsigned number to a log message
+ */
+extern void ASLogAppendUnsigned (ASLogBuffer *buffer, unsigned long long value);
+
+/*! \fn ASLogAppendDouble (ASLogBuffer *buffer, double value)
+ @brief Appends a floating point number to a log message, as %g
+ */
+extern void ASLogAppendDouble (ASLogBuffer *buffer, double value);
+
+/*! \fn ASLogAppendObject (ASLogBuffer *buffer, id object)
+ @brief Appends an object to a log message, as %@
+ */
+extern void ASLogAppendObject (ASLogBuffer *buffer, id object);
+
+/*! \fn ASLogBufferFull (ASLogBuffer *buffer)
+ @brief YES once nothing more fits in a log message
+ */
+extern BOOL ASLogBufferFull (ASLogBuffer *buffer);
+
+#pragma mark Protocols
+
+/*!
+ \brief Adopted by classes that write themselves into log messages.
+ 
+ An object logged with %@ whose class adopts ASLogFormattable is asked to append 
+ itself to the message with the ASLogAppend...() functions, rather than for its 
+ -description. Nothing is allocated and whatever does not fit is cut off.
+ */
+@protocol ASLogFormattable <NSObject>
+
+//! @brief Appends the receiver to a log message
+- (void)appendToLog:(ASLogBuffer *)buffer;
+
+@end
+
 
 #pragma mark Class interface
 
@@ -297,8 +532,44 @@ extern void QuietLog (NSString *format, ...);
 //! @brief NSLog, adds "WARNING" and also logs source file, line number and calling method
 + (void)warn:(char *)sourceFile lineNumber:(int)lineNumber function:(char *)functionName format:(NSString *)format, ...;
 
+//! @brief NSLog, adds "WARNING", logs source file and line number and a raw backtrace
++ (void)warnTrace:(char *)sourceFile lineNumber:(int)lineNumber format:(NSString *)format, ...;
+
+//! @brief NSLog, adds "WARNING", logs source file, line number, calling method and a raw backtrace
++ (void)warnTrace:(char *)sourceFile lineNumber:(int)lineNumber function:(char *)functionName format:(NSString *)format, ...;
+
 //@} (WARNING Logging methods)
 
+/*!
+ \name Binary Logging methods. 
+ - Fire according to level, as the debug, normal and warning methods do
+ */
+//@{
+
+//! @brief Logs a hex dump of a block of memory, also logs source file and line number
++ (void)hexLog:(char *)sourceFile lineNumber:(int)lineNumber level:(ASLogLevel)level bytes:(const void *)bytes length:(NSUInteger)length;
+
+//! @brief Logs a hex dump of an NSData's contents, also logs source file and line number
++ (void)hexLog:(char *)sourceFile lineNumber:(int)lineNumber level:(ASLogLevel)level data:(NSData *)data;
+
+//! @brief Logs a formatted prefix followed by a caller owned buffer, also logs source file and line number
++ (void)payloadLog:(char *)sourceFile lineNumber:(int)lineNumber level:(ASLogLevel)level bytes:(const void *)bytes length:(NSUInteger)length format:(NSString *)format, ...;
+
+//@} (Binary Logging methods)
+
+#if defined(__BLOCKS__)
+/*!
+ \name Deferred Logging methods. 
+ - Called via the Lazy Logging macros
+ */
+//@{
+
+//! @brief Logs the message a block returns, only running it if the line is logged
++ (void)lazyLog:(char *)sourceFile lineNumber:(int)lineNumber level:(ASLogLevel)level onWriter:(BOOL)onWriter block:(NSString *(^)(void))block;
+
+//@} (Deferred Logging methods)
+#endif
+
 /*!
  \name Control methods. 
  - Used to enable/disable logging for debugging methods and to redirect log output
@@ -311,12 +582,114 @@ extern void QuietLog (NSString *format, ...);
 //! @brief Switches logging methods between using NSLog() or QuietLog()
 + (void) setQuietOn: (BOOL) quietOn;
 
+//! @brief Switches logging methods to a fast substitute for NSLog() writing the same header
++ (void)setNSLogHeaderOn:(BOOL)headerOn;
+
+//! @brief Sets the pattern log lines are laid out with, "%W%[%f:%l %]%[in %F %]%m" by default
++ (BOOL)setPrefixPattern:(NSString *)pattern;
+
+//! @brief Registers a function appending instances of a class to log messages in place of -description
++ (BOOL)registerFormatter:(ASLogFormatter)formatter forClass:(Class)aClass;
+
+//! @brief Selects the layout used by the hex dump methods
++ (void)setHexStyle:(ASLogHexStyle)hexStyle;
+
+//! @brief Sets the maximum number of bytes a hex dump shows, 0 for no limit
++ (void)setHexLimit:(NSUInteger)hexLimit;
+
+//! @brief Enables/Disables raw backtraces on all warnings
++ (void)setWarnBacktraceOn:(BOOL)warnBacktraceOn;
+
+//! @brief Sets the lines per second above which a call site is throttled, 0 for never
++ (void)setSiteRateLimit:(NSUInteger)linesPerSecond;
+
+//! @brief Sets how many lines a throttled call site logs, 1 in oneIn
++ (void)setThrottledSampleRate:(NSUInteger)oneIn;
+
+//! @brief Sets the average seconds per line above which debug, then normal, lines are dropped
++ (void)setShedLatency:(NSTimeInterval)latency;
+
+//! @brief Switches output to a background writer thread, warnings in their own lane
++ (void)setAsyncOn:(BOOL)asyncOn;
+
+//! @brief Sets how the asynchronous writer thread waits for work
++ (void)setWriterWakeup:(ASLogWriterWakeup)wakeup interval:(NSTimeInterval)interval;
+
+//! @brief Pins the asynchronous writer thread to a CPU, -1 for none (Linux only)
++ (BOOL)setWriterCPU:(int)cpu;
+
+//! @brief Sets the nice value of the asynchronous writer thread, optionally SCHED_IDLE (Linux only)
++ (void)setWriterNice:(int)niceValue idle:(BOOL)idle;
+
+//! @brief Sets the size in bytes of the asynchronous queue, before it is first used
++ (void)setAsyncQueueSize:(NSUInteger)size;
+
+//! @brief Gives each NUMA node its own asynchronous queue in its own memory (Linux only)
++ (void)setAsyncNUMAOn:(BOOL)numaOn;
+
+//! @brief Backs the asynchronous queues with 2MB huge pages (Linux only)
++ (void)setAsyncHugePagesOn:(BOOL)hugePagesOn;
+
+//! @brief Sets the memory budget of the per-thread pools for lines too big for the asynchronous queue
++ (void)setAsyncPoolBudget:(NSUInteger)budget;
+
+//! @brief Sets what happens to a line too big for the asynchronous queue when the pools are out of budget
++ (void)setAsyncPoolFull:(ASLogPoolFull)full;
+
+//! @brief Gathers each thread's debug and normal lines in a buffer of its own, queued a chunk at a time
++ (void)setAsyncStagingOn:(BOOL)stagingOn interval:(NSUInteger)interval;
+
+//! @brief Leaves the -description of immutable %@ arguments to the writer thread
++ (void)setAsyncDeferDescriptionsOn:(BOOL)deferOn;
+
+//! @brief Lets the -description of a class's instances be left to the writer thread
++ (BOOL)deferDescriptionsForClass:(Class)aClass;
+
+//! @brief Waits until everything logged so far has been written
++ (void)flush;
+
+//! @brief Sets the length at which log messages are cut short
++ (void)setMaxRecordLength:(NSUInteger)maxRecordLength;
+
+//! @brief Sets a limit in bytes on all the memory ASLog allocates, 0 for none
++ (void)setMemoryBudget:(NSUInteger)budget;
+
+//! @brief Reports the memory ASLog is holding, by component
++ (NSString *)memoryReport;
+
 //! @brief Switches stderr to logging to a user specified file
 + (void)switchLoggingToFile:(NSString *)filePath fromAppDir:(BOOL)useAppDirAsBase;
 
+//! @brief Sends log output to a fixed size circular log file
++ (BOOL)switchLoggingToCircularFile:(NSString *)filePath capacity:(NSUInteger)capacity;
+
+//! @brief Stops using the circular log file
++ (void)closeCircularFile;
+
 //! @brief Switches stderr back to logging to default output stream
 + (void)restoreStdErr;
 
+//! @brief Sends log output to a file until the matching +popLogDestination, calls nest
++ (BOOL)pushLogDestination:(NSString *)filePath;
+
+//! @brief Sends log output to an open descriptor until the matching +popLogDestination
++ (BOOL)pushLogDescriptor:(int)fd;
+
+//! @brief Sends log output back to where it went before the last push
++ (BOOL)popLogDestination;
+
+//! @brief Also sends log output to an open descriptor, through its own queue and thread
++ (BOOL)addLogSink:(int)fd queueSize:(NSUInteger)queueSize;
+
+//! @brief As +addLogSink:queueSize:, optionally splicing into a pipe on Linux
++ (BOOL)addLogSink:(int)fd queueSize:(NSUInteger)queueSize splicing:(BOOL)splicing;
+
+//! @brief Stops sending log output to a sink, after writing what it has queued
++ (void)removeLogSink:(int)fd;
+
+//! @brief Lines a sink has dropped because it could not keep up
++ (NSUInteger)droppedLinesForLogSink:(int)fd;
+
 //@} (Control methods)
 
 @end
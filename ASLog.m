@@ -26,8 +26,509 @@
 
  */
 
+// for dl_iterate_phdr() and friends, must come before any system header
+#if !defined(__APPLE__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #import "ASLog.h"
 
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#if defined(__BLOCKS__)
+#include <Block.h>
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#include <mach/mach_time.h>
+#else
+#include <link.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#pragma mark Macro defintions
+
+/*! \def ASLogBacktraceDepth
+ @brief Maximum number of return addresses recorded for a warning backtrace
+ */
+#define ASLogBacktraceDepth 32
+
+/*! \def ASLogBacktraceReserve
+ @brief Space kept at the end of each format buffer for a backtrace: the label plus
+ " 0x" and 16 hex digits per address
+ */
+#define ASLogBacktraceReserve (16 + ASLogBacktraceDepth * 19)
+
+/*! \def ASLogSiteTableSize
+ @brief Number of call sites whose logging rate can be tracked, a power of 2
+ */
+#define ASLogSiteTableSize 1024
+
+/*! \def ASLogSiteProbeLimit
+ @brief Number of slots looked at for a call site before giving up on tracking it
+ */
+#define ASLogSiteProbeLimit 16
+
+/*! \def ASLogClassTableSize
+ @brief Number of classes whose ASLogFormatter can be cached, a power of 2
+ */
+#define ASLogClassTableSize 512
+
+/*! \def ASLogFormatterProbeLimit
+ @brief Number of slots looked at for a class, once they are all taken one of them is 
+ given to the class in place of another
+ */
+#define ASLogFormatterProbeLimit 16
+
+/*! \def ASLogMaxFormatters
+ @brief Most formatters +registerFormatter:forClass: can hold
+ */
+#define ASLogMaxFormatters 64
+
+/*! \def ASLogMaxDeferredObjects
+ @brief Most %@ arguments of one message whose -description can be left to the 
+ writer thread
+ */
+#define ASLogMaxDeferredObjects 8
+
+/*! \def ASLogMaxDeferredClasses
+ @brief Most classes +deferDescriptionsForClass: can hold
+ */
+#define ASLogMaxDeferredClasses 32
+
+/*! \def ASLogFormatCacheSize
+ @brief Number of string literal formats whose parse can be cached, a power of 2
+ */
+#define ASLogFormatCacheSize 1024
+
+/*! \def ASLogFormatProbeLimit
+ @brief Number of slots looked at for a format before giving up on caching it
+ */
+#define ASLogFormatProbeLimit 16
+
+/*! Argument sizes given by the length modifier of a conversion
+ */
+enum {
+	ASLogArgDefault = 0,	//!< int, unsigned, double, ...
+	ASLogArgChar,			//!< hh
+	ASLogArgShort,			//!< h
+	ASLogArgLong,			//!< l
+	ASLogArgLongLong,		//!< ll or q
+	ASLogArgLongDouble,		//!< L
+	ASLogArgSize,			//!< z
+	ASLogArgPtrDiff,		//!< t
+	ASLogArgIntMax			//!< j
+};
+
+/*! \def ASLogBulkChunk
+ @brief Most bytes written from the bulk lane before the warning lane is checked again
+ */
+#define ASLogBulkChunk (256 * 1024)
+
+/*! \def ASLogMaxNodes
+ @brief Most NUMA nodes given a bulk lane of their own
+ */
+#define ASLogMaxNodes 8
+
+/*! \def ASLogHugePageSize
+ @brief Huge page size lanes are rounded up to when backed by huge pages
+ */
+#define ASLogHugePageSize (2 * 1024 * 1024)
+
+/*! \def ASLogParkTimeout
+ @brief Longest the writer thread sleeps without checking the queue, in microseconds
+ */
+#define ASLogParkTimeout 100000
+
+/*! \def ASLogStageSize
+ @brief Size of a thread's staging buffer, see +setAsyncStagingOn:interval:
+ */
+#define ASLogStageSize 4096
+
+/*! \def ASLogRecordGranule
+ @brief Pooled records are allocated in multiples of this many bytes
+ */
+#define ASLogRecordGranule (64 * 1024)
+
+/*! \def ASLogMinimumRecordLength
+ @brief Message length a thread's format buffer falls back to when over the memory budget
+ */
+#define ASLogMinimumRecordLength 1024
+
+/*! \def ASLogMinimumQueueSize
+ @brief Smallest ring a lane is given when the memory budget is tight
+ */
+#define ASLogMinimumQueueSize (64 * 1024)
+
+/*! Parts of ASLog that allocate memory, charged against __sMemoryBudget
+ */
+enum {
+	ASLogMemoryFormatBuffers = 0,	//!< per-thread format buffers
+	ASLogMemoryQueues,				//!< lanes of the asynchronous queue
+	ASLogMemoryRecordPools,			//!< per-thread pools of oversized records
+	ASLogMemoryHexDumps,			//!< hex dumps being built
+	ASLogMemoryFormatCache,			//!< parsed formats
+	ASLogMemoryStaging,				//!< per-thread staging buffers
+	ASLogMemoryPrefixPatterns,		//!< compiled prefix patterns
+	ASLogMemoryComponents
+};
+
+/*! \def ASLogDestinationDepth
+ @brief How deeply +pushLogDestination: calls may nest
+ */
+#define ASLogDestinationDepth 16
+
+/*! \def ASLogMaxSinks
+ @brief Most sinks +addLogSink:queueSize: can hold
+ */
+#define ASLogMaxSinks 8
+
+/*! \def ASLogSinkFlushTimeout
+ @brief Longest +flush or +removeLogSink: waits for a sink to catch up, in seconds
+ */
+#define ASLogSinkFlushTimeout 1
+
+/*! \def ASLogSinkReclaimInterval
+ @brief How often an idle splicing sink's thread looks whether its pipe has been 
+ drained, in microseconds
+ */
+#define ASLogSinkReclaimInterval 1000
+
+/*! \def ASLogSinkSpliceMinimum
+ @brief Fewest queued bytes a splicing sink hands to its pipe with vmsplice(), less 
+ is written as usual
+ */
+#define ASLogSinkSpliceMinimum 65536
+
+/*! \def ASLogRingFileHeaderSize
+ @brief Bytes at the start of a circular log file kept for its ASLogRingFileHeader
+ */
+#define ASLogRingFileHeaderSize 4096
+
+/*! \def ASLogRingFileMagic
+ @brief First eight bytes of a circular log file
+ */
+#define ASLogRingFileMagic "ASLogRng"
+
+/*! \def ASLogDefaultPrefixPattern
+ @brief Prefix pattern used until +setPrefixPattern: is called, the layout ASLog has 
+ always used
+ */
+#define ASLogDefaultPrefixPattern "%W%[%f:%l %]%[in %F %]%m"
+
+/*! Operations a prefix pattern is compiled into, see ASLogPrefixCompile()
+ */
+enum {
+	ASLogPrefixLiteral = 0,		//!< copy text from the pattern
+	ASLogPrefixSection,			//!< start of a %[ %] section, skipped if a field in it is missing
+	ASLogPrefixTimestamp,		//!< %T, local date and time to the millisecond
+	ASLogPrefixLevel,			//!< %L, DEBUG, NORMAL or WARNING
+	ASLogPrefixWarning,			//!< %W, "WARNING: " for warnings, nothing otherwise
+	ASLogPrefixThread,			//!< %t, system thread ID
+	ASLogPrefixFile,			//!< %f, last path component of the source file
+	ASLogPrefixLine,			//!< %l, line number in the source file
+	ASLogPrefixFunction,		//!< %F, calling method/function
+	ASLogPrefixMessage			//!< %m, the message itself
+};
+
+/*! Fields a line may be logged without, as needed by an ASLogPrefixSection
+ */
+enum {
+	ASLogPrefixNeedsFile = 1,		//!< source file and line number
+	ASLogPrefixNeedsFunction = 2	//!< calling method/function
+};
+
+/*! Values of __sWriterParked
+ */
+enum {
+	ASLogWriterRunning = 0,		//!< the writer is busy, nobody need wake it
+	ASLogWriterParkedAny,		//!< the writer waits for any line
+	ASLogWriterParkedUrgent		//!< the writer sleeps out a batch interval, only warnings wake it
+};
+
+#pragma mark Types
+
+/*!
+ \brief A %@ argument whose -description is left to the writer thread, see 
+ ASLogBufferDefer().
+ */
+typedef struct {
+	size_t offset;		//!< where in the message its text goes
+	id object;			//!< the argument, retained
+} ASLogDeferredObject;
+
+/*!
+ \brief Bounded buffer that log messages are formatted into.
+ 
+ Each thread has one, kept under __sBufferKey, sized from __sMaxRecordLength. Nothing
+ is ever written past capacity, which leaves room for the truncation marker, a 
+ backtrace and the terminating NUL.
+ */
+struct ASLogBuffer {
+	char *bytes;		//!< the formatted text
+	size_t size;		//!< allocated size of bytes
+	size_t capacity;	//!< number of bytes of text the buffer may hold
+	size_t length;		//!< number of bytes of text it does hold
+	size_t trailer;		//!< bytes at the end of the text past the message, a backtrace
+	BOOL truncated;		//!< YES once something did not fit
+	BOOL inUse;			//!< YES while a message is being formatted into it
+	BOOL temporary;		//!< YES if freed on release rather than kept for the thread
+	unsigned depth;		//!< collection nesting of the object an ASLogFormatter is appending
+	BOOL deferring;		//!< YES if %@ arguments may be left to the writer thread
+	int objectCount;	//!< number of them left so far
+	ASLogDeferredObject objects[ASLogMaxDeferredObjects];	//!< the arguments left
+};
+
+/*!
+ \brief Logging rate of one call site, for throttling.
+ 
+ A call site is identified by its __FILE__ pointer and __LINE__, or for the 
+ unadorned methods, which have neither, by the format pointer with a line of 0.
+ Counts are kept per one second window.
+ */
+typedef struct {
+	const void * volatile key;		//!< __FILE__ or format pointer, NULL if the slot is free
+	int line;						//!< __LINE__, 0 if key is the format
+	volatile long window;			//!< the second being counted
+	volatile unsigned long count;	//!< lines logged or dropped so far in the window
+	volatile unsigned long suppressed;	//!< lines dropped since the site was throttled
+	volatile int throttled;			//!< non zero while the site is sampled
+} ASLogSite;
+
+/*!
+ \brief One step of a parsed log format, see ASLogFormatParse(): literal text, then 
+ optionally a conversion.
+ */
+typedef struct {
+	const char *text;	//!< text copied before the conversion
+	size_t length;		//!< bytes of text
+	char conversion;	//!< conversion character, 0 for text only
+	char argSize;		//!< ASLogArg size of the argument
+	char stars;			//!< number of '*' in spec, filled in from the arguments
+	char spec[45];		//!< printf() spec of the conversion, ready for vsnprintf()
+} ASLogFormatOp;
+
+/*!
+ \brief A class and the formatter its instances are appended with, see 
+ ASLogClassFormatter().
+ 
+ Readers take no lock: sequence is odd while the entry is being changed, and a reader
+ that sees it change under it looks again.
+ */
+typedef struct {
+	unsigned long sequence;		//!< bumped before and after each change
+	Class volatile key;			//!< the class, Nil if the slot is free
+	ASLogFormatter formatter;	//!< its formatter, NULL for -description
+} ASLogClassEntry;
+
+/*!
+ \brief A string literal format and its parsed steps, see ASLogFormatFind().
+ */
+typedef struct {
+	const void * volatile key;	//!< the format, NULL if the slot is free
+	ASLogFormatOp *ops;			//!< the steps, followed by the text they point into
+	int count;					//!< number of steps
+	BOOL positional;			//!< YES if the format has %n$ arguments, not run from the steps
+} ASLogFormatEntry;
+
+typedef struct ASLogPool ASLogPool;
+
+/*!
+ \brief A log line too big for the ring, queued alongside it.
+ 
+ Taken from the producing thread's ASLogPool and handed back to it by the writer 
+ thread, so it is never freed on a thread other than the one that allocated it.
+ */
+typedef struct ASLogRecord {
+	struct ASLogRecord *next;	//!< next in the lane's queue, or in a pool list
+	ASLogPool *pool;			//!< pool the record came from and goes back to
+	size_t position;			//!< lane head when queued, written once tail gets there
+	size_t capacity;			//!< bytes the record can hold
+	size_t length;				//!< bytes it does hold
+	void *deferred;				//!< block returning the message, run by the writer thread, or NULL
+	size_t split;				//!< with deferred or objects, length of the prefix
+	size_t end;					//!< with deferred or objects, where the suffix starts
+	ASLogDeferredObject *objects;	//!< %@ arguments of the message between split and end
+	int objectCount;			//!< number of objects, 0 if there are none
+	BOOL truncated;				//!< with objects, YES if the message was cut short before them
+	const ASLogCSite *site;		//!< C call site whose message goes between split and end, or NULL
+	ASLogCValue *values;		//!< with site, its arguments, c-strings copied into the record
+	char bytes[];				//!< the line, or with deferred its prefix and suffix
+} ASLogRecord;
+
+/*!
+ \brief Per-thread pool of ASLogRecords.
+ 
+ Only the owning thread touches the free list. The writer thread pushes records it 
+ has finished with onto returned without a lock, the owner takes the whole list back 
+ in one exchange. The pool lives until its thread has exited and every record out of 
+ it has come back. All pools are on the __sPools list so a forked child can free 
+ those of the threads it does not have.
+ */
+struct ASLogPool {
+	ASLogRecord *free;					//!< records ready for reuse
+	ASLogRecord * volatile returned;	//!< records back from the writer thread
+	volatile int references;			//!< one for the owning thread, one per record out
+	struct ASLogPool *next;				//!< next on __sPools, guarded by __sPoolLock
+};
+
+/*!
+ \brief One priority lane of the asynchronous queue.
+ 
+ A ring of bytes holding complete, formatted log lines ready to be written as they 
+ stand. head and tail count bytes ever added and removed, so head - tail is the 
+ number queued and (head % size) is where the next line goes. Producers append under
+ lock, the writer thread writes from tail without holding it and only takes the lock
+ to move tail on.
+ */
+typedef struct {
+	pthread_mutex_t lock;			//!< guards head, tail and the waiters count
+	pthread_cond_t space;			//!< signalled when the writer frees space
+	char *bytes;					//!< the ring
+	size_t size;					//!< size of the ring
+	volatile size_t head;			//!< bytes ever queued
+	volatile size_t tail;			//!< bytes ever written
+	int waiters;					//!< producers waiting for space
+	BOOL blocking;					//!< YES to wait for space when full, NO to drop the line
+	volatile unsigned long dropped;	//!< lines dropped because the lane was full
+	ASLogRecord *records;			//!< oversized lines queued, in order, guarded by lock
+	ASLogRecord *lastRecord;		//!< last of records
+} ASLogLane;
+
+/*!
+ \brief Per-thread staging buffer for debug and normal lines, see 
+ +setAsyncStagingOn:interval:
+ 
+ Lines are gathered here and copied into the lane in one go, so the lane's lock is 
+ taken once per chunk rather than once per line. The lock is only ever contended by 
+ the writer thread flushing a stage left waiting too long. All stages are on the 
+ __sStages list so the writer thread can find them.
+ */
+typedef struct ASLogStage {
+	pthread_mutex_t lock;		//!< guards the lines, taken by the owner and the writer thread
+	struct ASLogStage *next;	//!< next on __sStages, guarded by __sStageLock
+	ASLogLane *lane;			//!< lane the lines go to, picked when the first is staged
+	uint64_t since;				//!< ASLogNow() when the first line was staged
+	size_t length;				//!< bytes staged
+	unsigned long lines;		//!< lines staged
+	char bytes[ASLogStageSize];	//!< the lines
+} ASLogStage;
+
+/*!
+ \brief An extra destination with its own queue and writer thread, see 
+ +addLogSink:queueSize:splicing:
+ 
+ Fed a copy of the bytes of every write ASLog makes, so lines are formatted once 
+ however many sinks there are. A sink that falls behind drops lines of its own and 
+ holds nothing else up.
+ 
+ Bytes spliced into a pipe are not copied, the pipe holds the ring's pages until they 
+ are read, so while any are in the pipe tail stays where the first of them was 
+ queued. Once the pipe has been drained tail catches up with sent.
+ 
+ The lock and conditions outlive the sink, the slot keeps them for the next one, so 
+ ASLogSinkFeed() can take the lock of a sink it saw in __sSinkMask however late.
+ */
+typedef struct {
+	BOOL used;					//!< YES if the slot holds a sink
+	BOOL initialized;			//!< YES once the slot's lock and conditions are set up
+	BOOL active;				//!< YES while the sink is fed, changed under lock and __sSinkLock
+	int fd;						//!< the sink's descriptor, non-blocking unless a file
+	pthread_mutex_t lock;		//!< guards active, head, tail, the drop counts and closing
+	pthread_cond_t ready;		//!< signalled when bytes are queued or the sink is removed
+	pthread_cond_t drained;		//!< signalled each time the writer thread has written
+	pthread_t thread;			//!< the sink's writer thread
+	char *bytes;				//!< the ring
+	size_t size;				//!< size of the ring
+	size_t head;				//!< bytes ever queued
+	size_t sent;				//!< bytes ever written or spliced into the sink
+	size_t tail;				//!< bytes ever done with, whose space in the ring can be reused
+	size_t piped;				//!< bytes ever queued up to the end of the last spliced
+	uint64_t stalled;			//!< when the pipe was first seen still holding them, or 0
+	unsigned long dropped;		//!< lines dropped since last noted in the sink's output
+	unsigned long droppedTotal;	//!< lines ever dropped, see +droppedLinesForLogSink:
+	BOOL closing;				//!< YES once removed, the thread writes what is left and exits
+	BOOL finished;				//!< YES once the thread is done with the sink
+	BOOL abandoned;				//!< YES if +removeLogSink: stopped waiting, the thread frees the sink
+	BOOL splicing;				//!< YES to vmsplice() big runs of the ring into the sink, a pipe
+	BOOL socket;				//!< YES if the sink is a socket, sent to with MSG_DONTWAIT
+	BOOL midLine;				//!< YES if the last write stopped partway through a line
+} ASLogSink;
+
+/*!
+ \brief Header of a circular log file, see +switchLoggingToCircularFile:capacity:
+ 
+ The data area follows at ASLogRingFileHeaderSize. head counts every byte ever 
+ written, so the next byte goes at (head % capacity) in the data area. Once the file 
+ has wrapped the oldest byte still there is at tail, which is head - capacity, and 
+ the line it starts in may have been partly overwritten. All fields are 64 bits in 
+ the writing machine's byte order, so Tools/aslog-cat can read them with od.
+ */
+typedef struct {
+	char magic[8];		//!< ASLogRingFileMagic
+	uint64_t version;	//!< 1
+	uint64_t capacity;	//!< size of the data area
+	uint64_t head;		//!< bytes ever written
+	uint64_t tail;		//!< bytes ever written that have since been overwritten
+} ASLogRingFileHeader;
+
+/*!
+ \brief One operation of a compiled prefix pattern.
+ */
+typedef struct {
+	int opcode;			//!< one of the ASLogPrefix operations
+	int needs;			//!< ASLogPrefixSection: the ASLogPrefixNeeds fields used in the section
+	int skip;			//!< ASLogPrefixSection: number of operations in the section
+	size_t length;		//!< ASLogPrefixLiteral: bytes of text
+	const char *text;	//!< ASLogPrefixLiteral: the text, unescaped
+} ASLogPrefixOp;
+
+/*!
+ \brief A prefix pattern compiled by ASLogPrefixCompile(), see +setPrefixPattern:
+ 
+ The operations before the message make up the prefix of a line, those after it the
+ suffix. Allocated in one block along with the literal text of the operations and a 
+ copy of the pattern.
+ */
+typedef struct ASLogPrefixProgram {
+	struct ASLogPrefixProgram *next;	//!< program compiled before it, see __sPrefixPrograms
+	size_t size;			//!< bytes allocated
+	const char *pattern;	//!< the pattern compiled
+	int count;				//!< number of operations
+	int message;			//!< index of the ASLogPrefixMessage operation
+	ASLogPrefixOp ops[];	//!< the operations, in order
+} ASLogPrefixProgram;
+
 #pragma mark Static globals
 
 /*! \var BOOL __sDebugLoggingOn
@@ -45,477 +546,6620 @@
  */
 static BOOL __sDebugLoggingOn = NO;
 
-/*! \var void (*__sCurLogFunc)(NSString *format, ...);
- \brief Function pointer to the logging function used by log...:/debugLog...:/warn...: methods.
+/*! \var void (*__sCurLogFunc)(NSString *format, ...);
+ \brief Function pointer to the logging function used by log...:/debugLog...:/warn...: methods.
+ 
+ Function pointer - called by all the log...:/debugLog...:/warn...: methods to output their
+ log text. Currently will be either NSLog() (the default) or QuietLog().
+ 
+ QUietLog() can be selected at build time by defining the DEBUG_LOG_QUIET_ENABLE macro
+ or programmatically with the +setQuietOn: method at runtime.
+ */
+static void (*__sCurLogFunc)(NSString *format, ...);
+
+/*! Logging function chosen with +setQuietOn:, NSLog() or QuietLog(), which 
+ +setNSLogHeaderOn: goes back to when the fast header is turned off.
+ */
+static void (*__sPlainLogFunc)(NSString *format, ...);
+
+/*! Duplicate of the stderr descriptor on entry, so stderr can be put back after 
+ redirection whatever it was: a file, a tty, a pipe or a socket.
+ */
+static int __sStdErrSaved = -1;
+
+/*! Duplicates of the stderr descriptor saved by +pushLogDestination:, innermost last.
+ */
+static int __sDestinationStack[ASLogDestinationDepth];
+
+/*! Number of entries in __sDestinationStack.
+ */
+static int __sDestinationDepth = 0;
+
+/*! Serializes changes of stderr's destination.
+ */
+static pthread_mutex_t __sDestinationLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! \var ASLogHexStyle __sHexStyle
+ \brief Layout used by the hexLog...: methods
+ 
+ Either the classic offset/hex/ASCII dump (the default) or compact hex. Changed with
+ the +setHexStyle: method.
+ */
+static ASLogHexStyle __sHexStyle = ASLogHexStyleDump;
+
+/*! \var NSUInteger __sHexLimit
+ \brief Maximum number of bytes shown by the hexLog...: methods
+ 
+ Longer buffers are truncated and the number of bytes not shown is logged instead. 
+ Zero means no limit. Changed with the +setHexLimit: method.
+ */
+static NSUInteger __sHexLimit = 4096;
+
+/*! \var NSUInteger __sMaxRecordLength
+ \brief Maximum length of a formatted log message, in bytes
+ 
+ Formatting stops as soon as a message reaches this length, so one log call with a huge
+ argument can neither use unbounded memory nor take unbounded time. Messages that were 
+ cut short end with __sTruncationMarker. Changed with the +setMaxRecordLength: method.
+ */
+static NSUInteger __sMaxRecordLength = 16384;
+
+/*! Marker appended to messages cut short at __sMaxRecordLength
+ */
+static const char __sTruncationMarker[] = " ...[truncated]";
+
+/*! Descriptor of the circular log file, -1 when log lines go to stderr.
+ */
+static volatile int __sRingFile = -1;
+
+/*! The circular log file's header, as last written.
+ */
+static ASLogRingFileHeader __sRingHeader;
+
+/*! Serializes writes to the circular log file within the process.
+ */
+static pthread_mutex_t __sRingFileLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Path of the circular log file, reopened by a forked child, see 
+ ASLogRingFileForkChild().
+ */
+static char *__sRingFilePath = NULL;
+
+/*! Set once the process has forked with a circular log file open. Processes sharing
+ the file then take turns with flock() and reread the header each time. Each has the
+ file open on its own, flock() does not keep apart the holders of one descriptor.
+ */
+static volatile BOOL __sRingFileShared = NO;
+
+/*! \var NSUInteger __sMemoryBudget
+ \brief Most memory, in bytes, ASLog may allocate, 0 for no limit
+ 
+ Changed with the +setMemoryBudget: method.
+ */
+static volatile NSUInteger __sMemoryBudget = 0;
+
+/*! Memory allocated now, in bytes, for each ASLogMemory component.
+ */
+static volatile NSUInteger __sMemoryUsed[ASLogMemoryComponents];
+
+/*! Sum of __sMemoryUsed, checked against __sMemoryBudget.
+ */
+static volatile NSUInteger __sMemoryTotal = 0;
+
+/*! Number of allocations refused because of __sMemoryBudget.
+ */
+static volatile unsigned long __sMemoryRefused = 0;
+
+/*! Names of the ASLogMemory components, for +memoryReport.
+ */
+static const char *__sMemoryComponentNames[ASLogMemoryComponents] = {
+	"format buffers", "asynchronous queues", "record pools", "hex dumps", "format cache", 
+	"staging buffers", "prefix patterns"
+};
+
+/*! Key for the per-thread ASLogBuffer. Created in +initialize.
+ */
+static pthread_key_t __sBufferKey;
+
+/*! Key for the per-thread ASLogPool. Created in +initialize.
+ */
+static pthread_key_t __sPoolKey;
+
+/*! Every ASLogPool not yet freed, guarded by __sPoolLock.
+ */
+static ASLogPool *__sPools = NULL;
+
+/*! Serializes adding and removing __sPools.
+ */
+static pthread_mutex_t __sPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! \var NSUInteger __sPoolBudget
+ \brief Most memory, in bytes, all the record pools together may hold
+ 
+ 0 turns the pools off. Changed with the +setAsyncPoolBudget: method.
+ */
+static volatile NSUInteger __sPoolBudget = 4 * 1024 * 1024;
+
+
+/*! \var ASLogPoolFull __sPoolFull
+ \brief What happens to an oversized line when the pools are out of budget
+ 
+ Changed with the +setAsyncPoolFull: method.
+ */
+static volatile ASLogPoolFull __sPoolFull = ASLogPoolFullWrite;
+
+/*! \var BOOL __sDeferDescriptionsOn
+ \brief Controls leaving -description of immutable %@ arguments to the writer thread
+ 
+ Flag boolean - only has an effect in asynchronous mode. Is NO by default. Changed 
+ with the +setAsyncDeferDescriptionsOn: method.
+ */
+static volatile BOOL __sDeferDescriptionsOn = NO;
+
+/*! Classes added with +deferDescriptionsForClass:. A class is written before the 
+ count is raised, so reading them takes no lock.
+ */
+static Class __sDeferredClasses[ASLogMaxDeferredClasses];
+static volatile int __sDeferredClassCount = 0;
+
+/*! Serializes adding classes to __sDeferredClasses.
+ */
+static pthread_mutex_t __sDeferredClassLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! \var BOOL __sWarnBacktraceOn
+ \brief Controls backtraces on the warn...: methods
+ 
+ Flag boolean - if YES every warning records the return addresses of its call stack.
+ Is NO by default, the #ASWarnTrace and #ASFnWarnTrace macros record them regardless.
+ Changed with the +setWarnBacktraceOn: method.
+ */
+static BOOL __sWarnBacktraceOn = NO;
+
+/*! Number of loaded images when the image map was last logged, so that it is logged 
+ again if libraries have been loaded since.
+ */
+static unsigned long __sImageMapCount = 0;
+
+/*! \var NSUInteger __sSiteRateLimit
+ \brief Lines per second above which a single call site is throttled
+ 
+ A site logging faster than this is switched to logging only 1 in __sThrottledSampleRate 
+ of its lines until its rate drops back below the limit. Zero turns throttling off. 
+ Changed with the +setSiteRateLimit: method.
+ */
+static NSUInteger __sSiteRateLimit = 10000;
+
+/*! \var NSUInteger __sThrottledSampleRate
+ \brief A throttled call site logs 1 in this many lines
+ 
+ Changed with the +setThrottledSampleRate: method.
+ */
+static NSUInteger __sThrottledSampleRate = 100;
+
+/*! Logging rates of the call sites seen so far, open addressed on the site. Sites are
+ only ever added.
+ */
+static ASLogSite __sSites[ASLogSiteTableSize];
+
+/*! Serializes adding sites to __sSites, looking them up takes no lock.
+ */
+static pthread_mutex_t __sSiteLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Formatters registered with +registerFormatter:forClass:.
+ */
+static ASLogFormatter __sFormatters[ASLogMaxFormatters];
+
+/*! The class each of __sFormatters was registered for.
+ */
+static Class __sFormatterClasses[ASLogMaxFormatters];
+
+/*! Number of __sFormatters in use.
+ */
+static int __sFormatterCount = 0;
+
+/*! Classes logged with %@ and the formatter each resolved to, open addressed on the 
+ class. A slot is never freed, but once a class's probe window is full it takes one 
+ of the window's slots from another class, see ASLogClassFormatter().
+ */
+static ASLogClassEntry __sClassFormatters[ASLogClassTableSize];
+
+/*! Which slot of a full probe window is taken next, turn and turn about.
+ */
+static unsigned int __sClassFormatterVictim = 0;
+
+/*! Serializes registering formatters and adding classes to __sClassFormatters, 
+ looking them up takes no lock.
+ */
+static pthread_mutex_t __sFormatterLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! String literal formats seen so far and their parsed steps, open addressed on the 
+ format. Formats are only ever added.
+ */
+static ASLogFormatEntry __sFormats[ASLogFormatCacheSize];
+
+/*! Serializes adding formats to __sFormats, looking them up takes no lock.
+ */
+static pthread_mutex_t __sFormatLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Class of string literals, the only formats cached in __sFormats. Set in +initialize.
+ */
+static Class __sConstantStringClass = Nil;
+
+/*! \var uint64_t __sShedLatency
+ \brief Average output latency, in microseconds, above which lower levels are shed
+ 
+ While writing log lines takes longer than this on average the least important level
+ still being logged is dropped, one level a second: first debug, then normal lines.
+ Warnings are never dropped. Zero turns shedding off. Changed with the +setShedLatency:
+ method.
+ */
+static uint64_t __sShedLatency = 50000;
+
+/*! Number of levels currently shed: 0 none, 1 debug lines, 2 debug and normal lines.
+ Lines whose ASLogLevel is below this are dropped.
+ */
+static volatile int __sShedLevel = 0;
+
+/*! Moving average of the time taken to output a log line, in microseconds.
+ */
+static volatile uint64_t __sWriteLatency = 0;
+
+/*! Time, from ASLogNow(), at which shedding was last stepped up or down.
+ */
+static volatile uint64_t __sShedChecked = 0;
+
+/*! Time, from ASLogNow(), at which a shed line was last let through to measure latency.
+ */
+static volatile uint64_t __sShedProbe = 0;
+
+/*! Number of lines dropped since shedding started.
+ */
+static volatile unsigned long __sShedDropped = 0;
+
+/*! \var BOOL __sAsyncOn
+ \brief Controls asynchronous output
+ 
+ Flag boolean - if YES log lines are formatted on the calling thread and queued, a 
+ background writer thread writes them to stderr. Is NO by default. Changed with the 
+ +setAsyncOn: method.
+ */
+static volatile BOOL __sAsyncOn = NO;
+
+/*! \var NSUInteger __sAsyncQueueSize
+ \brief Size in bytes of the bulk lane, which holds debug and normal lines
+ 
+ The warning lane is a sixteenth of this, but at least 64KB. Changed with the 
+ +setAsyncQueueSize: method, before asynchronous output is first turned on.
+ */
+static NSUInteger __sAsyncQueueSize = 1024 * 1024;
+
+/*! Lane for warnings, always drained first. Never drops, producers wait for space.
+ */
+static ASLogLane __sWarningLane;
+
+/*! Lanes for debug and normal lines, one for each NUMA node when __sAsyncNUMAOn is
+ set, otherwise just the first. Drop lines when full.
+ */
+static ASLogLane __sBulkLanes[ASLogMaxNodes];
+
+/*! Number of __sBulkLanes in use.
+ */
+static int __sBulkLaneCount = 1;
+
+/*! Sinks added with +addLogSink:queueSize:.
+ */
+static ASLogSink __sSinks[ASLogMaxSinks];
+
+/*! One bit for each active slot of __sSinks, published with a release store once the
+ sink is set up and read by ASLogSinkFeed() with an acquire load. 0 skips feeding 
+ sinks altogether.
+ */
+static unsigned int __sSinkMask = 0;
+
+/*! Taken for writing to add or remove a sink, for reading to look one up.
+ */
+static pthread_rwlock_t __sSinkLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*! \var BOOL __sStagingOn
+ \brief YES to gather each thread's debug and normal lines before queueing them
+ 
+ Changed with the +setAsyncStagingOn:interval: method.
+ */
+static volatile BOOL __sStagingOn = NO;
+
+/*! \var uint64_t __sStageInterval
+ \brief Longest a line is left in a staging buffer, in microseconds
+ 
+ Changed with the +setAsyncStagingOn:interval: method.
+ */
+static volatile uint64_t __sStageInterval = 1000;
+
+/*! Key for the per-thread ASLogStage. Created in +initialize.
+ */
+static pthread_key_t __sStageKey;
+
+/*! Every thread's ASLogStage, guarded by __sStageLock.
+ */
+static ASLogStage *__sStages = NULL;
+
+/*! Serializes adding and removing __sStages and the writer thread walking them.
+ */
+static pthread_mutex_t __sStageLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Number of stages holding lines, so the writer thread knows to wake up for them.
+ */
+static volatile int __sStagesPending = 0;
+
+/*! \var BOOL __sAsyncNUMAOn
+ \brief YES to give each NUMA node its own bulk lane, in that node's memory
+ 
+ Changed with the +setAsyncNUMAOn: method, before asynchronous output is first turned
+ on. Linux only.
+ */
+static BOOL __sAsyncNUMAOn = NO;
+
+/*! \var BOOL __sAsyncHugePages
+ \brief YES to back the lanes with 2MB huge pages
+ 
+ Changed with the +setAsyncHugePagesOn: method, before asynchronous output is first 
+ turned on. Linux only.
+ */
+static BOOL __sAsyncHugePages = NO;
+
+/*! Set while the writer thread is waiting for work, so producers only signal it then.
+ One of ASLogWriterRunning, ASLogWriterParkedAny or ASLogWriterParkedUrgent. On Linux
+ the writer sleeps on it as a futex.
+ */
+static volatile int __sWriterParked = ASLogWriterRunning;
+
+/*! \var ASLogWriterWakeup __sWriterWakeup
+ \brief How the writer thread waits for work
+ 
+ Changed, together with __sWriterInterval, with the +setWriterWakeup:interval: method.
+ */
+static volatile ASLogWriterWakeup __sWriterWakeup = ASLogWriterWakeupBlock;
+
+/*! Spin time for ASLogWriterWakeupSpinThenBlock, batch interval for 
+ ASLogWriterWakeupInterval, in microseconds.
+ */
+static volatile uint64_t __sWriterInterval = 0;
+
+/*! \var int __sWriterCPU
+ \brief CPU the writer thread is pinned to, -1 to let it run on any
+ 
+ Changed with the +setWriterCPU: method. Linux only.
+ */
+static volatile int __sWriterCPU = -1;
+
+/*! \var int __sWriterNice
+ \brief Nice value of the writer thread
+ 
+ Changed with the +setWriterNice:idle: method. Linux only.
+ */
+static volatile int __sWriterNice = 0;
+
+/*! \var BOOL __sWriterIdle
+ \brief YES to run the writer thread under SCHED_IDLE
+ 
+ Changed with the +setWriterNice:idle: method. Linux only.
+ */
+static volatile BOOL __sWriterIdle = NO;
+
+/*! Set when a writer setting has changed, the writer thread applies the settings to 
+ itself when it next looks.
+ */
+static volatile BOOL __sWriterSettingsChanged = YES;
+
+/*! YES once the writer thread has been started.
+ */
+static BOOL __sWriterStarted = NO;
+
+/*! Serializes starting the writer thread, and is held across fork().
+ */
+static pthread_mutex_t __sStartLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Lock for parking and waking the writer thread, and for waiting on it to drain.
+ */
+static pthread_mutex_t __sWakeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Signalled to wake the writer thread.
+ */
+static pthread_cond_t __sWakeCond = PTHREAD_COND_INITIALIZER;
+
+/*! Broadcast by the writer thread whenever it has emptied both lanes.
+ */
+static pthread_cond_t __sDrainedCond = PTHREAD_COND_INITIALIZER;
+
+/*! \var ASLogPrefixProgram *__sPrefixProgram
+ \brief Compiled prefix pattern every line is laid out with
+ 
+ Compiled from ASLogDefaultPrefixPattern in +initialize, replaced with the
+ +setPrefixPattern: method. A program that has been replaced is not freed, another
+ thread may still be running it, see ASLogPrefixProgramFor().
+ */
+static ASLogPrefixProgram * volatile __sPrefixProgram = NULL;
+
+/*! Every prefix pattern compiled so far, newest first, kept for reuse.
+ */
+static ASLogPrefixProgram *__sPrefixPrograms = NULL;
+
+/*! Serializes adding to __sPrefixPrograms.
+ */
+static pthread_mutex_t __sPrefixLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! System ID of the calling thread, 0 until ASLogThreadID() first asks for it.
+ */
+static __thread unsigned long __sThreadID = 0;
+
+/*! Second that __sDate holds the local date and time of, for the calling thread.
+ */
+static __thread time_t __sDateSecond = -1;
+
+/*! Local date and time to the second, "2026-10-18 14:03:27", for the calling thread.
+ */
+static __thread char __sDate[32];
+
+/*! YES on the writer thread. Lines it logs itself, from a deferred block or a 
+ -description, are written there and then rather than queued behind lanes only it 
+ empties.
+ */
+static __thread BOOL __sOnWriter = NO;
+
+/*! Process ID written in NSLog() headers, kept up to date across fork() by 
+ ASLogPrefixForked().
+ */
+static int __sProcessID = 0;
+
+/*! Process name written in NSLog() headers, set by +setNSLogHeaderOn:
+ */
+static char *__sProcessName = NULL;
+
+/*! Lookup table for the scalar nibble to ASCII conversion. Also used as the shuffle
+ table by the NEON version.
+ */
+static const char __sHexDigits[] = "0123456789abcdef";
+
+static void ASLogEmit(struct iovec *iov, int count);
+static void ASLogNotice(NSString *format, ...);
+static uint64_t ASLogNow(void);
+static void ASLogDeadline(struct timespec *until, uint64_t timeout);
+static void ASLogSinkFeed(const struct iovec *iov, int count);
+
+
+/*!
+ \brief Optional quieter substitute for NSLog() for logging output.
+ 
+ NSLog() is very noisy - all that date, time and process clutter beginning each line. 
+ QuietLog() prints only what you ask it to.
+ 
+ QuietLog() has one significant difference to NSLog(). NSLog() output is intercepted by 
+ the system and sent to /var/log/system.log. Logging is only directed to whatever stream 
+ stderr is currently directed to.
+ 
+ The ASLog logging/warning methods can be switched to use QuietLog() thse ways:
+ 
+	Programmatically: call the +setQuietOn: class method
+	
+	At compile time by defining the DEBUG_LOG_QUIET_ENABLE macro
+ 
+ QuietLog() created by Mark Dalrymple @ Big Nerd Ranch
+ <https://www.bignerdranch.com/blog/a-quieter-log/>
+ 
+ @param format - NSString * that holds the formatting string (vide NSLog()).
+ 
+ @param ...	- variadic argument list.
+ */
+void QuietLog (NSString *format, ...)
+{
+    va_list argList;
+    va_start (argList, format);
+	
+    NSString *message = [[NSString alloc] initWithFormat: format
+											   arguments: argList];
+	
+	// no ARC in this build so...
+	[message autorelease];
+	
+    va_end (argList);
+	
+    struct iovec iov[2];
+    const char *utf8 = [message UTF8String];
+	
+    iov[0].iov_base = (void *)utf8;
+    iov[0].iov_len = strlen(utf8);
+    iov[1].iov_base = "\n";
+    iov[1].iov_len = 1;
+    ASLogEmit(iov, 2);
+	
+}
+
+
+#pragma mark Output helpers
+
+/*!
+ @brief Returns the last path component of a c-string path without allocating.
+ 
+ @param path - c-string path, usually __FILE__.
+ 
+ @return pointer into path just past the last '/', or path itself.
+ */
+static const char *ASLogBaseName(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	
+	return (slash == NULL ? path : slash + 1);
+}
+
+
+/*!
+ @brief Steps a vector of buffers past bytes that have gone out.
+ 
+ @param iov - in/out, the first buffer left, partly trimmed.
+ 
+ @param count - in/out, number of buffers left.
+ 
+ @param length - bytes that went out.
+ */
+static void ASLogSkipVector(struct iovec **iov, int *count, size_t length)
+{
+	// step past the buffers that went out completely
+	while (*count > 0 && length >= (*iov)->iov_len) {
+		length -= (*iov)->iov_len;
+		(*iov)++;
+		(*count)--;
+	}
+	if (*count > 0) {
+		(*iov)->iov_base = (char *)(*iov)->iov_base + length;
+		(*iov)->iov_len -= length;
+	}
+}
+
+
+/*!
+ @brief Writes all of an iovec array, retrying after short writes and EINTR.
+ 
+ The iovec array is modified as it is consumed.
+ 
+ @param fd - file descriptor to write to.
+ 
+ @param iov - array of buffers to write, in order.
+ 
+ @param count - number of entries in iov.
+ 
+ @return YES if everything was written, NO on error.
+ */
+static BOOL ASLogWriteVector(int fd, struct iovec *iov, int count)
+{
+	ssize_t written;
+	
+	while (count > 0) {
+		written = writev(fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return NO;
+		}
+		ASLogSkipVector(&iov, &count, written);
+	}
+	return YES;
+}
+
+
+/*!
+ @brief Waits until a non-blocking descriptor can be written to, or a deadline passes.
+ 
+ @param fd - the descriptor.
+ 
+ @param deadline - when to give up, from ASLogNow().
+ 
+ @return YES if fd can be written to, or has an error for the write to report. NO 
+ once the deadline has passed.
+ */
+static BOOL ASLogPollWritable(int fd, uint64_t deadline)
+{
+	struct pollfd entry;
+	uint64_t now;
+	int result;
+	
+	entry.fd = fd;
+	entry.events = POLLOUT;
+	for (;;) {
+		now = ASLogNow();
+		if (now >= deadline)
+			return NO;
+		entry.revents = 0;
+		result = poll(&entry, 1, (int)((deadline - now + 999) / 1000));
+		if (result > 0)
+			return YES;
+		if (result < 0 && errno != EINTR)
+			return NO;
+	}
+}
+
+
+/*!
+ @brief Writes all of an iovec array to a sink, waiting for it at most until a 
+ deadline.
+ 
+ As ASLogWriteVector(), but the sink's descriptor does not block: while it is full 
+ the write waits with poll(), so a reader that has stalled holds the sink's thread up
+ only until the deadline.
+ 
+ @param sink - the ASLogSink.
+ 
+ @param iov - in/out, the buffers to write, left at the first byte not written.
+ 
+ @param count - in/out, number of buffers left.
+ 
+ @param deadline - when to give up, from ASLogNow().
+ 
+ @return YES if everything was written, NO on an error or once the deadline passed.
+ */
+static BOOL ASLogSinkWriteVector(ASLogSink *sink, struct iovec **iov, int *count, uint64_t deadline)
+{
+	struct msghdr message;
+	ssize_t written;
+	
+	while (*count > 0) {
+		if (sink->socket) {
+			memset(&message, 0, sizeof(message));
+			message.msg_iov = *iov;
+			message.msg_iovlen = *count;
+			written = sendmsg(sink->fd, &message, MSG_DONTWAIT);
+		} else
+			written = writev(sink->fd, *iov, *count);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && ASLogPollWritable(sink->fd, deadline))
+				continue;
+			return NO;
+		}
+		ASLogSkipVector(iov, count, written);
+	}
+	return YES;
+}
+
+
+/*!
+ @brief Splices a vector of buffers into a pipe with vmsplice(), which maps their pages
+ into the pipe rather than copy them.
+ 
+ The buffers must not change until the pipe's reader has read them, see 
+ ASLogSinkReclaim(). While the pipe is full it waits with poll(), up to a deadline. 
+ Stops short on an error or at the deadline. Where vmsplice() is not available or fd 
+ turns out not to be a pipe it clears *splicing, and what is left is for 
+ ASLogSinkWriteVector().
+ 
+ @param fd - file descriptor of a pipe, non-blocking.
+ 
+ @param iov - in/out, the buffers to splice, left at the first byte not spliced.
+ 
+ @param count - in/out, number of buffers left.
+ 
+ @param splicing - BOOL *, cleared if fd could not be spliced into.
+ 
+ @param deadline - when to give up, from ASLogNow().
+ 
+ @return the number of bytes spliced.
+ */
+static size_t ASLogSpliceVector(int fd, struct iovec **iov, int *count, BOOL *splicing, uint64_t deadline)
+{
+	size_t total = 0;
+#if defined(__linux__)
+	ssize_t spliced;
+	
+	while (*count > 0) {
+		spliced = vmsplice(fd, *iov, *count, SPLICE_F_NONBLOCK);
+		if (spliced < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				if (ASLogPollWritable(fd, deadline))
+					continue;
+				return total;
+			}
+			if (errno != EINVAL && errno != EBADF && errno != ENOSYS)
+				return total;
+			break;
+		}
+		total += spliced;
+		ASLogSkipVector(iov, count, spliced);
+	}
+	if (*count == 0)
+		return total;
+#endif
+	*splicing = NO;
+	return total;
+}
+
+
+#pragma mark Circular log file
+
+/*!
+ @brief Writes pieces of a log line into the circular log file's data area.
+ 
+ Splits the pieces where the data area wraps, and writes each run with pwritev(), 
+ again after EINTR or a short write until all of it is written. Gives up on an error.
+ 
+ @param fd - the circular log file.
+ 
+ @param position - where the first byte goes, as a count of bytes ever written.
+ 
+ @param iov - the pieces, consumed as they are written.
+ 
+ @param count - number of pieces.
+ */
+static void ASLogRingFileWrite(int fd, uint64_t position, struct iovec *iov, int count)
+{
+	struct iovec run[16], *next;
+	uint64_t capacity = __sRingHeader.capacity, offset, room, used;
+	ssize_t written;
+	int runCount;
+	
+	while (count > 0) {
+		offset = position % capacity;
+		room = capacity - offset;
+		used = 0;
+		for (runCount = 0; count > 0 && runCount < 16 && used < room; runCount++) {
+			run[runCount] = *iov;
+			if (iov->iov_len > room - used) {
+				run[runCount].iov_len = room - used;
+				iov->iov_base = (char *)iov->iov_base + (room - used);
+				iov->iov_len -= room - used;
+			} else {
+				iov++;
+				count--;
+			}
+			used += run[runCount].iov_len;
+		}
+		// write all of the run, a gap would show old lines in the middle of new ones
+		for (next = run; runCount > 0; offset += written) {
+			written = pwritev(fd, next, runCount, ASLogRingFileHeaderSize + offset);
+			if (written < 0 && errno == EINTR) {
+				written = 0;
+				continue;
+			}
+			if (written <= 0)
+				return;
+			ASLogSkipVector(&next, &runCount, written);
+		}
+		position += used;
+	}
+}
+
+
+/*!
+ @brief Appends a log line to the circular log file, overwriting the oldest lines.
+ 
+ The data goes in first and the header after it, so a reader never sees head past 
+ what has been written. A line bigger than the whole file keeps only its end.
+ 
+ @param iov - the pieces of the line, consumed.
+ 
+ @param count - number of pieces.
+ 
+ @return NO if the file has been closed or its header cannot be read or written, the
+ line has not been written.
+ */
+static BOOL ASLogRingFileAppend(struct iovec *iov, int count)
+{
+	ASLogRingFileHeader previous;
+	uint64_t length = 0, skip, left;
+	int fd, i;
+	
+	for (i = 0; i < count; i++)
+		length += iov[i].iov_len;
+	
+	pthread_mutex_lock(&__sRingFileLock);
+	fd = __sRingFile;
+	if (fd < 0) {
+		pthread_mutex_unlock(&__sRingFileLock);
+		return NO;
+	}
+	if (__sRingFileShared) {
+		while (flock(fd, LOCK_EX) != 0 && errno == EINTR)
+			;
+		if (pread(fd, &__sRingHeader, sizeof(__sRingHeader), 0) != sizeof(__sRingHeader)) {
+			flock(fd, LOCK_UN);
+			pthread_mutex_unlock(&__sRingFileLock);
+			return NO;
+		}
+	}
+	previous = __sRingHeader;
+	
+	skip = (length > __sRingHeader.capacity ? length - __sRingHeader.capacity : 0);
+	for (left = skip; left > 0; ) {
+		if (iov->iov_len <= left) {
+			left -= iov->iov_len;
+			iov++;
+			count--;
+		} else {
+			iov->iov_base = (char *)iov->iov_base + left;
+			iov->iov_len -= left;
+			left = 0;
+		}
+	}
+	ASLogRingFileWrite(fd, __sRingHeader.head + skip, iov, count);
+	
+	__sRingHeader.head += length;
+	if (__sRingHeader.head > __sRingHeader.capacity)
+		__sRingHeader.tail = __sRingHeader.head - __sRingHeader.capacity;
+	if (pwrite(fd, &__sRingHeader, sizeof(__sRingHeader), 0) != sizeof(__sRingHeader)) {
+		// the line is not in the file as far as a reader can tell
+		__sRingHeader = previous;
+		length = 0;
+	}
+	
+	if (__sRingFileShared)
+		flock(fd, LOCK_UN);
+	pthread_mutex_unlock(&__sRingFileLock);
+	return (length > 0);
+}
+
+
+/*!
+ @brief Opens, or creates, a circular log file.
+ 
+ An existing file with the same capacity is carried on from where it stopped, 
+ anything else at the path is replaced.
+ 
+ @param header - set to the file's header.
+ 
+ @return the descriptor, or -1.
+ */
+static int ASLogRingFileOpen(const char *path, uint64_t capacity, ASLogRingFileHeader *header)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	
+	if (fd < 0)
+		return -1;
+	if (pread(fd, header, sizeof(*header), 0) != sizeof(*header)
+		|| memcmp(header->magic, ASLogRingFileMagic, sizeof(header->magic)) != 0
+		|| header->version != 1 || header->capacity != capacity || header->head < header->tail) {
+		memset(header, 0, sizeof(*header));
+		memcpy(header->magic, ASLogRingFileMagic, sizeof(header->magic));
+		header->version = 1;
+		header->capacity = capacity;
+		if (ftruncate(fd, 0) != 0 || ftruncate(fd, ASLogRingFileHeaderSize + capacity) != 0
+			|| pwrite(fd, header, sizeof(*header), 0) != sizeof(*header)) {
+			close(fd);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+
+/*!
+ @brief pthread_atfork() prepare handler, holds off fork() while a line is half written.
+ */
+static void ASLogRingFileForkPrepare(void)
+{
+	pthread_mutex_lock(&__sRingFileLock);
+}
+
+
+/*!
+ @brief pthread_atfork() parent handler.
+ 
+ From now on more than one process may write the file, so they take turns.
+ */
+static void ASLogRingFileForkParent(void)
+{
+	__sRingFileShared = YES;
+	pthread_mutex_unlock(&__sRingFileLock);
+}
+
+
+/*!
+ @brief pthread_atfork() child handler.
+ 
+ The descriptor inherited from the parent shares its open file, and so its flock(), 
+ so the child opens the file again for a lock of its own. If the path no longer leads
+ to the same file the child's lines go to stderr instead.
+ */
+static void ASLogRingFileForkChild(void)
+{
+	struct stat inherited, reopened;
+	int fd = -1;
+	
+	if (__sRingFile >= 0) {
+		if (__sRingFilePath != NULL && fstat(__sRingFile, &inherited) == 0)
+			fd = open(__sRingFilePath, O_RDWR);
+		if (fd >= 0 && (fstat(fd, &reopened) != 0 || reopened.st_dev != inherited.st_dev 
+						|| reopened.st_ino != inherited.st_ino)) {
+			close(fd);
+			fd = -1;
+		}
+		close(__sRingFile);
+		__sRingFile = fd;
+	}
+	__sRingFileShared = YES;
+	pthread_mutex_unlock(&__sRingFileLock);
+}
+
+
+/*!
+ @brief Writes a log line wherever log lines currently go.
+ 
+ That is the circular log file if one is open, otherwise stderr. Every line ASLog 
+ writes itself goes through here; lines handed to NSLog() go wherever it sends them.
+ 
+ @param iov - the pieces of the line, consumed as they are written.
+ 
+ @param count - number of pieces.
+ */
+static void ASLogEmit(struct iovec *iov, int count)
+{
+	// before the write, which may move iov on
+	if (__atomic_load_n(&__sSinkMask, __ATOMIC_RELAXED) != 0)
+		ASLogSinkFeed(iov, count);
+	if (__sRingFile < 0 || !ASLogRingFileAppend(iov, count))
+		ASLogWriteVector(fileno(stderr), iov, count);
+}
+
+#pragma mark Memory budget
+
+/*!
+ @brief Charges memory about to be allocated to a component.
+ 
+ @param component - ASLogMemory component allocating.
+ 
+ @param size - bytes to be allocated.
+ 
+ @return NO, and nothing charged, if that would take ASLog over __sMemoryBudget. 
+ The caller then makes do with less, or drops what it was doing.
+ */
+static BOOL ASLogMemoryReserve(int component, size_t size)
+{
+	if (__sync_add_and_fetch(&__sMemoryTotal, size) > __sMemoryBudget && __sMemoryBudget != 0) {
+		__sync_fetch_and_sub(&__sMemoryTotal, size);
+		__sync_fetch_and_add(&__sMemoryRefused, 1);
+		return NO;
+	}
+	__sync_fetch_and_add(&__sMemoryUsed[component], size);
+	return YES;
+}
+
+
+/*!
+ @brief Gives back memory charged with ASLogMemoryReserve(), once it is freed.
+ */
+static void ASLogMemoryRelease(int component, size_t size)
+{
+	__sync_fetch_and_sub(&__sMemoryUsed[component], size);
+	__sync_fetch_and_sub(&__sMemoryTotal, size);
+}
+
+#pragma mark Sinks
+
+/*!
+ @brief Counts the lines in some bytes of output, for the dropped counts.
+ */
+static unsigned long ASLogCountLines(const char *bytes, size_t length)
+{
+	unsigned long lines = 0;
+	const char *end = bytes + length;
+	
+	while ((bytes = memchr(bytes, '\n', end - bytes)) != NULL) {
+		lines++;
+		bytes++;
+	}
+	return lines;
+}
+
+
+/*!
+ @brief Copies the pieces of a write into every active sink's queue.
+ 
+ Never waits for a sink: if one's queue is full the lines are dropped from that sink
+ alone and counted.
+ 
+ Takes no lock but each sink's own: which sinks there are is read from __sSinkMask. 
+ A sink removed since is seen to be inactive once its lock is held, and skipped.
+ 
+ @param iov - the pieces, whole lines.
+ 
+ @param count - number of pieces.
+ */
+static void ASLogSinkFeed(const struct iovec *iov, int count)
+{
+	ASLogSink *sink;
+	size_t length = 0, offset, first;
+	unsigned long lines;
+	unsigned int mask;
+	BOOL empty;
+	int i, s;
+	
+	for (i = 0; i < count; i++)
+		length += iov[i].iov_len;
+	mask = __atomic_load_n(&__sSinkMask, __ATOMIC_ACQUIRE);
+	for (s = 0; mask != 0; s++, mask >>= 1) {
+		if ((mask & 1) == 0)
+			continue;
+		sink = &__sSinks[s];
+		pthread_mutex_lock(&sink->lock);
+		if (!sink->active) {
+			pthread_mutex_unlock(&sink->lock);
+			continue;
+		}
+		if (sink->size - (sink->head - sink->tail) < length) {
+			for (i = 0, lines = 0; i < count; i++)
+				lines += ASLogCountLines(iov[i].iov_base, iov[i].iov_len);
+			sink->dropped += lines;
+			sink->droppedTotal += lines;
+		} else {
+			empty = (sink->head == sink->sent);
+			for (i = 0; i < count; i++) {
+				offset = sink->head % sink->size;
+				first = (iov[i].iov_len < sink->size - offset ? iov[i].iov_len : sink->size - offset);
+				memcpy(sink->bytes + offset, iov[i].iov_base, first);
+				memcpy(sink->bytes, (const char *)iov[i].iov_base + first, iov[i].iov_len - first);
+				sink->head += iov[i].iov_len;
+			}
+			if (empty)
+				pthread_cond_signal(&sink->ready);
+		}
+		pthread_mutex_unlock(&sink->lock);
+	}
+}
+
+
+/*!
+ @brief Opens a sink's own descriptor for the one it is given, one its thread never 
+ blocks on.
+ 
+ A pipe, FIFO or tty is reopened on Linux through /proc, which gives the sink an open
+ file description of its own to make non-blocking and leaves fd as it was. Elsewhere,
+ or if that fails, it is duplicated and the description they share made non-blocking.
+ A socket is duplicated and sent to with MSG_DONTWAIT. A file is just duplicated, 
+ writes to it do not wait on a reader.
+ 
+ @param fd - the descriptor passed to +addLogSink:queueSize:splicing:.
+ 
+ @param socket - BOOL *, set if fd is a socket.
+ 
+ @return the sink's descriptor, close-on-exec, or -1.
+ */
+static int ASLogSinkOpen(int fd, BOOL *socket)
+{
+	struct stat status;
+	int flags, sinkFd;
+#if defined(__linux__)
+	char path[32];
+#endif
+	
+	if (fstat(fd, &status) != 0 || (flags = fcntl(fd, F_GETFL)) < 0)
+		return -1;
+	*socket = S_ISSOCK(status.st_mode);
+	if (!S_ISFIFO(status.st_mode) && !S_ISCHR(status.st_mode))
+		return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+#if defined(__linux__)
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	if ((sinkFd = open(path, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC)) >= 0)
+		return sinkFd;
+#endif
+	if ((sinkFd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) >= 0)
+		fcntl(sinkFd, F_SETFL, flags | O_NONBLOCK);
+	return sinkFd;
+}
+
+
+/*!
+ @brief Allocates the memory for a sink's ring.
+ 
+ On Linux it is mmap()ed rather than malloc()ed, so that pages a pipe still holds 
+ when the ring is let go of are not handed out again, see ASLogSinkReclaim().
+ 
+ @param size - size of the ring, a whole number of pages on Linux.
+ 
+ @return the ring, or NULL.
+ */
+static char *ASLogSinkAllocate(size_t size)
+{
+#if defined(__linux__)
+	void *bytes = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	
+	return (bytes == MAP_FAILED ? NULL : bytes);
+#else
+	return malloc(size);
+#endif
+}
+
+
+/*!
+ @brief Frees a sink's ring, from ASLogSinkAllocate().
+ 
+ Pages a pipe still holds stay with the pipe until they are read.
+ 
+ @param bytes - the ring.
+ 
+ @param size - size of the ring.
+ */
+static void ASLogSinkDeallocate(char *bytes, size_t size)
+{
+#if defined(__linux__)
+	munmap(bytes, size);
+#else
+	free(bytes);
+#endif
+}
+
+
+/*!
+ @brief Frees the space in a splicing sink's ring taken by bytes spliced into its 
+ pipe, once the pipe has been drained.
+ 
+ An empty pipe holds none of the ring's pages, whoever else writes to it. If other 
+ writers keep it from ever being empty, after ASLogSinkFlushTimeout the ring is 
+ copied to a new one and the old one left to the pipe, and the sink is written to 
+ from then on. Called by the sink's thread with the lock held.
+ 
+ @param sink - the ASLogSink.
+ */
+static void ASLogSinkReclaim(ASLogSink *sink)
+{
+#if defined(__linux__)
+	char *bytes;
+	int unread;
+	
+	if (sink->piped <= sink->tail)
+		return;
+	if (ioctl(sink->fd, FIONREAD, &unread) == 0 && unread > 0) {
+		if (sink->stalled == 0) {
+			sink->stalled = ASLogNow();
+			return;
+		}
+		if (ASLogNow() - sink->stalled < ASLogSinkFlushTimeout * 1000000
+			|| (bytes = ASLogSinkAllocate(sink->size)) == NULL)
+			return;
+		memcpy(bytes, sink->bytes, sink->size);
+		ASLogSinkDeallocate(sink->bytes, sink->size);
+		sink->bytes = bytes;
+		sink->splicing = NO;
+	}
+	// drained, or the pipe is gone and its pages with it
+	sink->piped = sink->tail = sink->sent;
+	sink->stalled = 0;
+	pthread_cond_broadcast(&sink->drained);
+#endif
+}
+
+
+/*!
+ @brief Frees a removed sink's queue and descriptor and gives its slot back, once its
+ thread is done with them.
+ 
+ The slot's lock and conditions are kept, ASLogSinkFeed() may still take the lock.
+ 
+ @param sink - the ASLogSink.
+ */
+static void ASLogSinkRelease(ASLogSink *sink)
+{
+	ASLogSinkDeallocate(sink->bytes, sink->size);
+	ASLogMemoryRelease(ASLogMemoryQueues, sink->size);
+	close(sink->fd);
+	pthread_rwlock_wrlock(&__sSinkLock);
+	sink->used = NO;
+	pthread_rwlock_unlock(&__sSinkLock);
+}
+
+
+/*!
+ @brief Counts the lines in part of a sink's ring.
+ 
+ @param sink - the ASLogSink.
+ 
+ @param from - the first byte, as a count of bytes ever queued.
+ 
+ @param length - bytes to look at, at most the size of the ring.
+ 
+ @return the number of '\n's.
+ */
+static unsigned long ASLogSinkCountLines(ASLogSink *sink, size_t from, size_t length)
+{
+	size_t offset = from % sink->size, first;
+	
+	first = (length < sink->size - offset ? length : sink->size - offset);
+	return ASLogCountLines(sink->bytes + offset, first) + ASLogCountLines(sink->bytes, length - first);
+}
+
+
+/*!
+ @brief Body of a sink's writer thread.
+ 
+ Writes whatever is queued, without holding the lock, and notes lines dropped since 
+ the last write in the output. The descriptor does not block: a write waits for a 
+ full sink with poll(), at most ASLogSinkFlushTimeout, and what is not written by 
+ then is dropped, as it is if the sink cannot be written to. SIGPIPE is blocked on 
+ the thread so a closed pipe or socket does just that rather than end the process. 
+ A line cut short is ended before the next note. Once the sink is removed what is 
+ left is written and the thread exits; if the sink stalls or fails then the rest is 
+ dropped too.
+ 
+ A splicing sink hands runs of at least ASLogSinkSpliceMinimum to its pipe with 
+ vmsplice(), and writes shorter ones, which copying does faster. While spliced bytes
+ are in the pipe their space is not reused and the thread looks every 
+ ASLogSinkReclaimInterval whether the pipe has been drained.
+ 
+ If +removeLogSink: stopped waiting for it first, the thread frees the sink itself.
+ 
+ @param context - the ASLogSink.
+ */
+static void *ASLogSinkMain(void *context)
+{
+	ASLogSink *sink = context;
+	struct iovec iov[2], *vector;
+	char notice[128];
+	struct timespec until;
+	size_t used, start, first, spliced, rest;
+	unsigned long dropped, lost;
+	uint64_t deadline;
+	sigset_t pipe;
+	BOOL abandoned;
+	int pieces, i;
+	
+	sigemptyset(&pipe);
+	sigaddset(&pipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe, NULL);
+	pthread_mutex_lock(&sink->lock);
+	for (;;) {
+		ASLogSinkReclaim(sink);
+		if (sink->head == sink->sent && sink->dropped == 0) {
+			if (sink->closing)
+				break;
+			if (sink->piped <= sink->tail)
+				pthread_cond_wait(&sink->ready, &sink->lock);
+			else {
+				ASLogDeadline(&until, ASLogSinkReclaimInterval);
+				pthread_cond_timedwait(&sink->ready, &sink->lock, &until);
+			}
+			continue;
+		}
+		used = sink->head - sink->sent;
+		start = sink->sent % sink->size;
+		dropped = sink->dropped;
+		sink->dropped = 0;
+		pthread_mutex_unlock(&sink->lock);
+		
+		deadline = ASLogNow() + ASLogSinkFlushTimeout * 1000000;
+		spliced = rest = 0;
+		if (dropped != 0) {
+			iov[0].iov_base = notice;
+			iov[0].iov_len = snprintf(notice, sizeof(notice), "%sASLog: %lu lines dropped, the sink fell behind\n", 
+									  (sink->midLine ? "\n" : ""), dropped);
+			vector = iov;
+			pieces = 1;
+			if (ASLogSinkWriteVector(sink, &vector, &pieces, deadline))
+				sink->midLine = NO;
+		}
+		if (used > 0) {
+			first = (used < sink->size - start ? used : sink->size - start);
+			iov[0].iov_base = sink->bytes + start;
+			iov[0].iov_len = first;
+			iov[1].iov_base = sink->bytes;
+			iov[1].iov_len = used - first;
+			vector = iov;
+			pieces = (used > first ? 2 : 1);
+			if (sink->splicing && used >= ASLogSinkSpliceMinimum) {
+				spliced = ASLogSpliceVector(sink->fd, &vector, &pieces, &sink->splicing, deadline);
+				if (spliced > 0)
+					sink->piped = sink->sent + spliced;
+			}
+			if (pieces > 0 && (spliced == 0 || !sink->splicing))
+				ASLogSinkWriteVector(sink, &vector, &pieces, deadline);
+			for (i = 0; i < pieces; i++)
+				rest += vector[i].iov_len;
+		}
+		lost = 0;
+		if (rest > 0) {
+			// what went out stays out, the lines of the rest are dropped
+			lost = ASLogSinkCountLines(sink, sink->sent + used - rest, rest);
+			if (rest < used)
+				sink->midLine = (sink->bytes[(start + used - rest - 1) % sink->size] != '\n');
+		} else if (used > 0)
+			sink->midLine = NO;
+		
+		pthread_mutex_lock(&sink->lock);
+		sink->sent += used;
+		if (rest > 0 && sink->closing) {
+			// a removed sink that will not take its lines gets none of the rest either
+			lost += ASLogSinkCountLines(sink, sink->sent, sink->head - sink->sent);
+			sink->sent = sink->head;
+		} else
+			sink->dropped += lost;
+		sink->droppedTotal += lost;
+		if (sink->piped <= sink->tail)
+			sink->tail = sink->sent;
+		pthread_cond_broadcast(&sink->drained);
+	}
+	sink->finished = YES;
+	abandoned = sink->abandoned;
+	pthread_cond_broadcast(&sink->drained);
+	pthread_mutex_unlock(&sink->lock);
+	if (abandoned)
+		ASLogSinkRelease(sink);
+	return NULL;
+}
+
+
+/*!
+ @brief Waits, for a while, for every sink to write what it has queued.
+ 
+ A sink that cannot keep up is given at most ASLogSinkFlushTimeout, so that it holds
+ up neither +flush nor exit for long.
+ */
+static void ASLogSinksFlush(void)
+{
+	struct timespec until;
+	ASLogSink *sink;
+	int s;
+	
+	if (__atomic_load_n(&__sSinkMask, __ATOMIC_RELAXED) == 0)
+		return;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += ASLogSinkFlushTimeout;
+	pthread_rwlock_rdlock(&__sSinkLock);
+	for (s = 0; s < ASLogMaxSinks; s++) {
+		sink = &__sSinks[s];
+		if (!sink->active)
+			continue;
+		pthread_mutex_lock(&sink->lock);
+		while (sink->head != sink->sent)
+			if (pthread_cond_timedwait(&sink->drained, &sink->lock, &until) == ETIMEDOUT)
+				break;
+		pthread_mutex_unlock(&sink->lock);
+	}
+	pthread_rwlock_unlock(&__sSinkLock);
+}
+
+
+/*!
+ @brief pthread_atfork() prepare handler, holds off fork() while a sink is being 
+ added or removed.
+ */
+static void ASLogSinkForkPrepare(void)
+{
+	pthread_rwlock_wrlock(&__sSinkLock);
+}
+
+
+/*!
+ @brief pthread_atfork() parent handler.
+ */
+static void ASLogSinkForkParent(void)
+{
+	pthread_rwlock_unlock(&__sSinkLock);
+}
+
+
+/*!
+ @brief pthread_atfork() child handler.
+ 
+ The sinks' threads are not in the child, so each active sink is given an empty 
+ queue, what was queued is written by the parent, and a new thread. A sink whose 
+ thread cannot be started is no longer fed. A sink being removed is left to the 
+ parent, the child just closes its descriptor and frees its slot. Every slot's lock 
+ is set up again, a thread feeding the sink may have held it.
+ */
+static void ASLogSinkForkChild(void)
+{
+	ASLogSink *sink;
+	int s;
+	
+	pthread_rwlock_init(&__sSinkLock, NULL);
+	for (s = 0; s < ASLogMaxSinks; s++) {
+		sink = &__sSinks[s];
+		if (!sink->initialized)
+			continue;
+		pthread_mutex_init(&sink->lock, NULL);
+		pthread_cond_init(&sink->ready, NULL);
+		pthread_cond_init(&sink->drained, NULL);
+		if (!sink->active) {
+			if (sink->used) {
+				ASLogSinkDeallocate(sink->bytes, sink->size);
+				ASLogMemoryRelease(ASLogMemoryQueues, sink->size);
+				close(sink->fd);
+				sink->used = NO;
+			}
+			continue;
+		}
+		sink->head = sink->sent = sink->tail = sink->piped = 0;
+		sink->stalled = 0;
+		sink->dropped = 0;
+		sink->midLine = NO;
+		if (pthread_create(&sink->thread, NULL, ASLogSinkMain, sink) != 0) {
+			sink->active = NO;
+			__atomic_and_fetch(&__sSinkMask, ~(1u << s), __ATOMIC_RELEASE);
+		}
+	}
+}
+
+#pragma mark Hex encoding
+
+/*!
+ @brief Writes length bytes as lower case hex digits, two per byte.
+ 
+ Sixteen bytes at a time are converted with SIMD where the target has it (SSE2 or
+ AArch64 NEON), the tail and other targets go through the lookup table.
+ 
+ @param out - buffer to write to, must have room for 2 * length chars. Not terminated.
+ 
+ @param in - bytes to encode.
+ 
+ @param length - number of bytes to encode.
+ 
+ @return pointer to the char after the last one written.
+ */
+static char *ASLogHexEncode(char *out, const unsigned char *in, size_t length)
+{
+	size_t i = 0;
+	
+#if defined(__SSE2__)
+	const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+	const __m128i asciiZero = _mm_set1_epi8('0');
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i letterGap = _mm_set1_epi8('a' - '0' - 10);
+	for (; i + 16 <= length; i += 16, out += 32) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask);
+		__m128i lo = _mm_and_si128(bytes, nibbleMask);
+		// '0' + nibble, plus the gap up to 'a' for nibbles above 9
+		hi = _mm_add_epi8(_mm_add_epi8(hi, asciiZero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letterGap));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, asciiZero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letterGap));
+		_mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8x16_t digits = vld1q_u8((const uint8_t *)__sHexDigits);
+	for (; i + 16 <= length; i += 16, out += 32) {
+		uint8x16_t bytes = vld1q_u8(in + i);
+		uint8x16x2_t pair;
+		pair.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(bytes, 4));
+		pair.val[1] = vqtbl1q_u8(digits, vandq_u8(bytes, vdupq_n_u8(0x0f)));
+		vst2q_u8((uint8_t *)out, pair);
+	}
+#endif
+	
+	for (; i < length; i++) {
+		*out++ = __sHexDigits[in[i] >> 4];
+		*out++ = __sHexDigits[in[i] & 0x0f];
+	}
+	return out;
+}
+
+
+/*!
+ @brief Writes one line of a classic hex dump (as hexdump -C) for up to 16 bytes.
+ 
+ @param out - buffer to write to, must have room for 79 chars. Not terminated.
+ 
+ @param in - bytes to dump.
+ 
+ @param length - number of bytes to dump, 16 or less.
+ 
+ @param offset - offset of the first byte, printed at the start of the line.
+ 
+ @return pointer to the char after the last one written.
+ */
+static char *ASLogHexDumpLine(char *out, const unsigned char *in, size_t length, unsigned long offset)
+{
+	char hex[32];
+	size_t i;
+	int shift;
+	
+	for (shift = 28; shift >= 0; shift -= 4)
+		*out++ = __sHexDigits[(offset >> shift) & 0x0f];
+	*out++ = ' ';
+	
+	ASLogHexEncode(hex, in, length);
+	for (i = 0; i < 16; i++) {
+		if (i % 8 == 0)
+			*out++ = ' ';
+		if (i < length) {
+			out[0] = hex[2 * i];
+			out[1] = hex[2 * i + 1];
+		} else {
+			out[0] = out[1] = ' ';
+		}
+		out[2] = ' ';
+		out += 3;
+	}
+	
+	*out++ = ' ';
+	*out++ = '|';
+#if defined(__SSE2__)
+	if (length == 16) {
+		// printable is 0x20...0x7e, bytes from 0x80 up are negative so fail the first test
+		__m128i bytes = _mm_loadu_si128((const __m128i *)in);
+		__m128i printable = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)),
+										  _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7f)));
+		_mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_and_si128(printable, bytes),
+													  _mm_andnot_si128(printable, _mm_set1_epi8('.'))));
+		out += 16;
+		length = 0;
+	}
+#endif
+	for (i = 0; i < length; i++)
+		*out++ = (in[i] >= 0x20 && in[i] < 0x7f) ? (char)in[i] : '.';
+	*out++ = '|';
+	return out;
+}
+
+#pragma mark Bounded formatting
+
+/*!
+ @brief Destructor for the per-thread buffer, called as a thread exits.
+ */
+static void ASLogBufferFree(void *buffer)
+{
+	ASLogMemoryRelease(ASLogMemoryFormatBuffers, ((ASLogBuffer *)buffer)->size);
+	free(((ASLogBuffer *)buffer)->bytes);
+	free(buffer);
+}
+
+
+/*!
+ @brief Resizes a buffer's text, within the memory budget.
+ 
+ @return NO if the budget or memory ran out, the buffer is left as it was.
+ */
+static BOOL ASLogBufferResize(ASLogBuffer *buffer, size_t size)
+{
+	char *bytes;
+	
+	if (size > buffer->size && !ASLogMemoryReserve(ASLogMemoryFormatBuffers, size - buffer->size))
+		return NO;
+	bytes = realloc(buffer->bytes, size);
+	if (bytes == NULL) {
+		if (size > buffer->size)
+			ASLogMemoryRelease(ASLogMemoryFormatBuffers, size - buffer->size);
+		return NO;
+	}
+	if (size < buffer->size)
+		ASLogMemoryRelease(ASLogMemoryFormatBuffers, buffer->size - size);
+	buffer->bytes = bytes;
+	buffer->size = size;
+	return YES;
+}
+
+
+/*!
+ @brief Gets an empty buffer to format a message into.
+ 
+ Normally the calling thread's own buffer, allocated the first time the thread logs
+ and resized if __sMaxRecordLength has changed. If the thread's buffer is already in 
+ use, because a -description being formatted logs something itself, a temporary one is
+ allocated instead. If the memory budget does not stretch to __sMaxRecordLength the 
+ buffer holds ASLogMinimumRecordLength, or what it already had, and messages are 
+ truncated sooner.
+ 
+ @return the buffer, to be handed back with ASLogBufferRelease(), or NULL if out of memory.
+ */
+static ASLogBuffer *ASLogBufferAcquire(void)
+{
+	ASLogBuffer *buffer = pthread_getspecific(__sBufferKey);
+	size_t overhead = sizeof(__sTruncationMarker) + ASLogBacktraceReserve;
+	size_t size = __sMaxRecordLength + overhead;
+	
+	if (buffer == NULL || buffer->inUse) {
+		ASLogBuffer *fresh = calloc(1, sizeof(ASLogBuffer));
+		if (fresh == NULL)
+			return NULL;
+		fresh->temporary = (buffer != NULL);
+		if (!fresh->temporary)
+			pthread_setspecific(__sBufferKey, fresh);
+		buffer = fresh;
+	}
+	if (buffer->size != size && !ASLogBufferResize(buffer, size) && buffer->size == 0
+		&& (size <= ASLogMinimumRecordLength + overhead || !ASLogBufferResize(buffer, ASLogMinimumRecordLength + overhead))) {
+		if (buffer->temporary)
+			ASLogBufferFree(buffer);
+		return NULL;
+	}
+	buffer->capacity = (buffer->size < size ? buffer->size - overhead : __sMaxRecordLength);
+	buffer->length = 0;
+	buffer->trailer = 0;
+	buffer->truncated = NO;
+	buffer->deferring = NO;
+	buffer->objectCount = 0;
+	buffer->inUse = YES;
+	return buffer;
+}
+
+
+/*!
+ @brief Hands back a buffer obtained from ASLogBufferAcquire().
+ 
+ Any %@ arguments still left in it are released.
+ */
+static void ASLogBufferRelease(ASLogBuffer *buffer)
+{
+	int i;
+	
+	for (i = 0; i < buffer->objectCount; i++)
+		[buffer->objects[i].object release];
+	if (buffer->temporary)
+		ASLogBufferFree(buffer);
+	else
+		buffer->inUse = NO;
+}
+
+
+/*!
+ @brief Appends bytes to a buffer, stopping at its capacity.
+ 
+ @param buffer - buffer to append to.
+ 
+ @param bytes - bytes to append.
+ 
+ @param length - number of bytes to append.
+ 
+ @return NO if the buffer is now truncated.
+ */
+static BOOL ASLogBufferAppend(ASLogBuffer *buffer, const char *bytes, size_t length)
+{
+	size_t room = buffer->capacity - buffer->length;
+	
+	if (length > room) {
+		length = room;
+		buffer->truncated = YES;
+	}
+	memcpy(buffer->bytes + buffer->length, bytes, length);
+	buffer->length += length;
+	return !buffer->truncated;
+}
+
+
+/*!
+ @brief Appends UTF-16 characters to a buffer as UTF-8, stopping at its capacity.
+ 
+ Used for the %C and %S conversions so they do not need an NSString. Unpaired 
+ surrogates are replaced with U+FFFD.
+ 
+ @param buffer - buffer to append to.
+ 
+ @param characters - the characters to append.
+ 
+ @param length - number of characters.
+ */
+static void ASLogBufferAppendCharacters(ASLogBuffer *buffer, const unichar *characters, size_t length)
+{
+	unsigned char utf8[4];
+	unsigned long code;
+	size_t i, count;
+	
+	for (i = 0; i < length && !buffer->truncated; i++) {
+		code = characters[i];
+		if (code >= 0xd800 && code < 0xdc00 && i + 1 < length
+			&& characters[i + 1] >= 0xdc00 && characters[i + 1] < 0xe000) {
+			code = 0x10000 + ((code - 0xd800) << 10) + (characters[++i] - 0xdc00);
+		} else if (code >= 0xd800 && code < 0xe000) {
+			code = 0xfffd;
+		}
+		
+		if (code < 0x80) {
+			utf8[0] = (unsigned char)code;
+			count = 1;
+		} else if (code < 0x800) {
+			utf8[0] = (unsigned char)(0xc0 | (code >> 6));
+			utf8[1] = (unsigned char)(0x80 | (code & 0x3f));
+			count = 2;
+		} else if (code < 0x10000) {
+			utf8[0] = (unsigned char)(0xe0 | (code >> 12));
+			utf8[1] = (unsigned char)(0x80 | ((code >> 6) & 0x3f));
+			utf8[2] = (unsigned char)(0x80 | (code & 0x3f));
+			count = 3;
+		} else {
+			utf8[0] = (unsigned char)(0xf0 | (code >> 18));
+			utf8[1] = (unsigned char)(0x80 | ((code >> 12) & 0x3f));
+			utf8[2] = (unsigned char)(0x80 | ((code >> 6) & 0x3f));
+			utf8[3] = (unsigned char)(0x80 | (code & 0x3f));
+			count = 4;
+		}
+		// never split a character at the end of the buffer
+		if (buffer->capacity - buffer->length < count)
+			buffer->truncated = YES;
+		else
+			ASLogBufferAppend(buffer, (const char *)utf8, count);
+	}
+}
+
+
+/*!
+ @brief Appends an NSString to a buffer as UTF-8, stopping at its capacity.
+ 
+ Only as much of the string as fits is converted, and never part of a character.
+ 
+ @param buffer - buffer to append to.
+ 
+ @param string - the string to append.
+ */
+static void ASLogBufferAppendString(ASLogBuffer *buffer, NSString *string)
+{
+	NSUInteger used = 0;
+	NSRange remaining = NSMakeRange(0, 0);
+	
+	if (buffer->truncated)
+		return;
+	[string getBytes:(buffer->bytes + buffer->length)
+		   maxLength:(buffer->capacity - buffer->length)
+		  usedLength:&used
+			encoding:NSUTF8StringEncoding
+			 options:NSStringEncodingConversionAllowLossy
+			   range:NSMakeRange(0, [string length])
+	  remainingRange:&remaining];
+	buffer->length += used;
+	if (remaining.length > 0)
+		buffer->truncated = YES;
+}
+
+
+/*!
+ @brief Appends the contents of an NSData to a buffer as -description would, stopping
+ at its capacity.
+ 
+ Only the bytes that fit are encoded, however long the data.
+ 
+ @param buffer - buffer to append to.
+ 
+ @param data - the data to append.
+ */
+static void ASLogBufferAppendData(ASLogBuffer *buffer, NSData *data)
+{
+	const unsigned char *bytes = [data bytes];
+	NSUInteger length = [data length], i, group;
+	char hex[8];
+	
+	ASLogBufferAppend(buffer, "<", 1);
+	for (i = 0; i < length && !buffer->truncated; i += 4) {
+		group = (length - i < 4 ? length - i : 4);
+		if (i > 0)
+			ASLogBufferAppend(buffer, " ", 1);
+		ASLogHexEncode(hex, bytes + i, group);
+		ASLogBufferAppend(buffer, hex, 2 * group);
+	}
+	ASLogBufferAppend(buffer, ">", 1);
+}
+
+
+/*!
+ @brief ASLogFormatter for classes that adopt ASLogFormattable.
+ */
+static void ASLogAppendFormattable(id object, ASLogBuffer *buffer)
+{
+	[(id <ASLogFormattable>)object appendToLog:buffer];
+}
+
+
+/*!
+ @brief Works out the formatter for a class: the one registered for it or its nearest
+ superclass, else ASLogAppendFormattable() if it adopts ASLogFormattable.
+ 
+ Called with __sFormatterLock held.
+ 
+ @param aClass - the class.
+ 
+ @return the formatter, or NULL to use -description.
+ */
+static ASLogFormatter ASLogClassResolve(Class aClass)
+{
+	Class superclass;
+	int i;
+	
+	for (superclass = aClass; superclass != Nil; superclass = [superclass superclass])
+		for (i = 0; i < __sFormatterCount; i++)
+			if (__sFormatterClasses[i] == superclass)
+				return __sFormatters[i];
+	if ([aClass conformsToProtocol:@protocol(ASLogFormattable)])
+		return ASLogAppendFormattable;
+	return NULL;
+}
+
+
+/*!
+ @brief Reads a class and its formatter from a slot of __sClassFormatters, without a 
+ lock.
+ 
+ The slot's sequence is loaded before and after the rest: if it was odd or changed 
+ meanwhile the slot was being written, which takes a few stores, and it is read again.
+ 
+ @param entry - the slot.
+ 
+ @param formatter - out, the class's formatter.
+ 
+ @return the class, Nil if the slot is free.
+ */
+static Class ASLogClassEntryLoad(ASLogClassEntry *entry, ASLogFormatter *formatter)
+{
+	unsigned long sequence;
+	Class key;
+	
+	for (;;) {
+		sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+		if ((sequence & 1) == 0) {
+			key = __atomic_load_n(&entry->key, __ATOMIC_RELAXED);
+			*formatter = __atomic_load_n(&entry->formatter, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&entry->sequence, __ATOMIC_RELAXED) == sequence)
+				return key;
+		}
+	}
+}
+
+
+/*!
+ @brief Writes a class and its formatter into a slot of __sClassFormatters, for 
+ ASLogClassEntryLoad().
+ 
+ Called with __sFormatterLock held.
+ 
+ @param entry - the slot.
+ 
+ @param key - the class.
+ 
+ @param formatter - its formatter, NULL for -description.
+ */
+static void ASLogClassEntryStore(ASLogClassEntry *entry, Class key, ASLogFormatter formatter)
+{
+	__atomic_store_n(&entry->sequence, entry->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&entry->key, key, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->formatter, formatter, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->sequence, entry->sequence + 1, __ATOMIC_RELEASE);
+}
+
+
+/*!
+ @brief Finds the formatter for an object's class, working it out the first time the
+ class is seen.
+ 
+ Lookups are lock free, see ASLogClassEntryLoad(). Every class is cached, those that
+ go to -description too. Once all ASLogFormatterProbeLimit slots a class may use are 
+ taken it is given one of them in place of another class, which is worked out again 
+ the next time it is logged.
+ 
+ @param aClass - the class of the object being logged.
+ 
+ @return the formatter, or NULL to use -description.
+ */
+static ASLogFormatter ASLogClassFormatter(Class aClass)
+{
+	unsigned long hash = ((uintptr_t)aClass >> 3) * 2654435761UL;
+	ASLogClassEntry *entry;
+	ASLogFormatter formatter = NULL;
+	Class held;
+	int probe;
+	
+	for (probe = 0; probe < ASLogFormatterProbeLimit; probe++) {
+		entry = &__sClassFormatters[(hash + probe) & (ASLogClassTableSize - 1)];
+		held = ASLogClassEntryLoad(entry, &formatter);
+		if (held == aClass)
+			return formatter;
+		if (held == Nil)
+			break;
+	}
+	
+	pthread_mutex_lock(&__sFormatterLock);
+	formatter = ASLogClassResolve(aClass);
+	for (probe = 0; probe < ASLogFormatterProbeLimit; probe++) {
+		entry = &__sClassFormatters[(hash + probe) & (ASLogClassTableSize - 1)];
+		if (entry->key == aClass || entry->key == Nil)
+			break;
+	}
+	if (probe == ASLogFormatterProbeLimit)
+		entry = &__sClassFormatters[(hash + __sClassFormatterVictim++ % ASLogFormatterProbeLimit) 
+									& (ASLogClassTableSize - 1)];
+	ASLogClassEntryStore(entry, aClass, formatter);
+	pthread_mutex_unlock(&__sFormatterLock);
+	return formatter;
+}
+
+
+/*!
+ @brief Appends a %@ argument to a buffer, stopping at its capacity.
+ 
+ Strings and data are copied in directly. Arrays, sets and dictionaries are walked 
+ here, on one line, rather than through -description so that walking a huge 
+ collection stops once the buffer is full. Objects whose class has an ASLogFormatter,
+ see +registerFormatter:forClass: and ASLogFormattable, write themselves straight 
+ into the buffer. Anything else, or collections nested more than 8 deep, is logged 
+ with -description.
+ 
+ @param buffer - buffer to append to.
+ 
+ @param object - the object to append, may be nil.
+ 
+ @param depth - how deeply nested in collections the object is.
+ */
+static void ASLogBufferAppendObject(ASLogBuffer *buffer, id object, unsigned depth)
+{
+	NSEnumerator *enumerator;
+	id element;
+	BOOL isSet, first = YES;
+	ASLogFormatter formatter;
+	unsigned outer;
+	
+	if (object == nil) {
+		ASLogBufferAppend(buffer, "(null)", 6);
+	} else if ([object isKindOfClass:[NSString class]]) {
+		ASLogBufferAppendString(buffer, object);
+	} else if ([object isKindOfClass:[NSData class]]) {
+		ASLogBufferAppendData(buffer, object);
+	} else if (depth < 8 && ([object isKindOfClass:[NSArray class]] || [object isKindOfClass:[NSSet class]])) {
+		isSet = [object isKindOfClass:[NSSet class]];
+		ASLogBufferAppend(buffer, (isSet ? "{(" : "("), (isSet ? 2 : 1));
+		enumerator = [object objectEnumerator];
+		while (!buffer->truncated && (element = [enumerator nextObject]) != nil) {
+			if (!first)
+				ASLogBufferAppend(buffer, ", ", 2);
+			ASLogBufferAppendObject(buffer, element, depth + 1);
+			first = NO;
+		}
+		ASLogBufferAppend(buffer, (isSet ? ")}" : ")"), (isSet ? 2 : 1));
+	} else if (depth < 8 && [object isKindOfClass:[NSDictionary class]]) {
+		ASLogBufferAppend(buffer, "{", 1);
+		enumerator = [object keyEnumerator];
+		while (!buffer->truncated && (element = [enumerator nextObject]) != nil) {
+			ASLogBufferAppendObject(buffer, element, depth + 1);
+			ASLogBufferAppend(buffer, " = ", 3);
+			ASLogBufferAppendObject(buffer, [object objectForKey:element], depth + 1);
+			ASLogBufferAppend(buffer, "; ", 2);
+		}
+		ASLogBufferAppend(buffer, "}", 1);
+	} else if ((formatter = ASLogClassFormatter([object class])) != NULL) {
+		outer = buffer->depth;
+		buffer->depth = depth;
+		formatter(object, buffer);
+		buffer->depth = outer;
+	} else {
+		ASLogBufferAppendString(buffer, [object description]);
+	}
+}
+
+
+/*!
+ @brief Leaves a %@ argument for the writer thread to call -description on, if it 
+ cannot change in the meantime.
+ 
+ Strings and numbers cost as little to append now as to leave, so they are appended 
+ now. Dates are copied, which for an immutable one is just a retain. Instances of the
+ classes added with +deferDescriptionsForClass: are retained. Anything else is 
+ formatted now. Where the text goes is noted, see ASLogBufferExpand().
+ 
+ @param buffer - buffer being formatted into, with deferring set.
+ 
+ @param object - the argument.
+ 
+ @return YES if the argument was left, NO to format it now.
+ */
+static BOOL ASLogBufferDefer(ASLogBuffer *buffer, id object)
+{
+	int i, count = __sDeferredClassCount;
+	
+	if (object == nil || buffer->objectCount == ASLogMaxDeferredObjects)
+		return NO;
+	if ([object isKindOfClass:[NSString class]] || [object isKindOfClass:[NSNumber class]])
+		return NO;
+	if ([object isKindOfClass:[NSDate class]]) {
+		object = [object copy];
+	} else {
+		for (i = 0; i < count; i++)
+			if ([object isKindOfClass:__sDeferredClasses[i]])
+				break;
+		if (i == count)
+			return NO;
+		[object retain];
+	}
+	buffer->objects[buffer->objectCount].offset = buffer->length;
+	buffer->objects[buffer->objectCount].object = object;
+	buffer->objectCount++;
+	return YES;
+}
+
+
+/*!
+ @brief Appends a single printf() conversion to a buffer, stopping at its capacity.
+ 
+ The conversion is formatted straight into the buffer, the excess is cut off by 
+ vsnprintf() itself.
+ 
+ @param buffer - buffer to append to.
+ 
+ @param spec - printf() format holding one conversion.
+ 
+ @param ...	- the argument for the conversion.
+ 
+ @return NO if the buffer is now truncated.
+ */
+static BOOL ASLogBufferAppendFormat(ASLogBuffer *buffer, const char *spec, ...)
+{
+	va_list ap;
+	size_t room = buffer->capacity - buffer->length;
+	int written;
+	
+	// the buffer always has a byte spare past capacity for the terminator
+	va_start(ap, spec);
+	written = vsnprintf(buffer->bytes + buffer->length, room + 1, spec, ap);
+	va_end(ap);
+	if (written < 0)
+		return !buffer->truncated;
+	if ((size_t)written > room) {
+		written = (int)room;
+		buffer->truncated = YES;
+	}
+	buffer->length += written;
+	return !buffer->truncated;
+}
+
+
+/*!
+ @brief Appends a number in decimal to a buffer, stopping at its capacity.
+ 
+ Used for plain %d and %u, which need none of vsnprintf()'s work.
+ 
+ @param buffer - buffer to append to.
+ 
+ @param value - magnitude of the number.
+ 
+ @param negative - BOOL, YES for a '-' in front.
+ 
+ @return NO if the buffer is now truncated.
+ */
+static BOOL ASLogBufferAppendDecimal(ASLogBuffer *buffer, uintmax_t value, BOOL negative)
+{
+	char digits[24], *digit = digits + sizeof(digits);
+	
+	do {
+		*--digit = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+	if (negative)
+		*--digit = '-';
+	return ASLogBufferAppend(buffer, digit, digits + sizeof(digits) - digit);
+}
+
+
+/*!
+ @brief Tells whether a UTF-8 NSLog() style format has positional (%n$) arguments.
+ 
+ Only a '$' straight after the '%' and argument number of a conversion counts, one 
+ anywhere else, "$%.2f" say, is just text.
+ 
+ @param cursor - the format.
+ 
+ @return YES if a conversion takes its argument by position.
+ */
+static BOOL ASLogFormatPositional(const char *cursor)
+{
+	const char *digits;
+	
+	while ((cursor = strchr(cursor, '%')) != NULL) {
+		cursor++;
+		if (*cursor == '%') {
+			cursor++;
+			continue;
+		}
+		for (digits = cursor; *cursor >= '0' && *cursor <= '9'; cursor++)
+			;
+		if (*cursor == '$' && cursor > digits)
+			return YES;
+	}
+	return NO;
+}
+
+
+/*!
+ @brief Parses the next step of a UTF-8 NSLog() style format: the literal text up to
+ the next conversion and the conversion itself.
+ 
+ The printf() spec for the conversion is made ready to hand to vsnprintf(), with 
+ the length modifier the argument is widened to. '*' widths and precisions are left 
+ in the spec for ASLogFormatStep() to fill in. %% and conversions that are not 
+ understood become part of the text.
+ 
+ @param cursor - where to start, not at the end of the format.
+ 
+ @param op - the step, pointing into the format.
+ 
+ @return where the next step starts.
+ */
+static const char *ASLogFormatParse(const char *cursor, ASLogFormatOp *op)
+{
+	const char *percent;
+	char conversion;
+	int specLength, argSize;
+	
+	op->text = cursor;
+	op->conversion = 0;
+	op->stars = 0;
+	percent = strchr(cursor, '%');
+	if (percent == NULL) {
+		op->length = strlen(cursor);
+		return cursor + op->length;
+	}
+	op->length = percent - cursor;
+	cursor = percent + 1;
+	
+	// copy flags, width and precision into spec
+	op->spec[0] = '%';
+	specLength = 1;
+	while (*cursor != '\0' && strchr("-+ #0'", *cursor) != NULL && specLength < 8)
+		op->spec[specLength++] = *cursor++;
+	if (*cursor == '*') {
+		op->spec[specLength++] = *cursor++;
+		op->stars++;
+	} else {
+		while (*cursor >= '0' && *cursor <= '9' && specLength < 20)
+			op->spec[specLength++] = *cursor++;
+	}
+	if (*cursor == '.') {
+		op->spec[specLength++] = *cursor++;
+		if (*cursor == '*') {
+			op->spec[specLength++] = *cursor++;
+			op->stars++;
+		} else {
+			while (*cursor >= '0' && *cursor <= '9' && specLength < 32)
+				op->spec[specLength++] = *cursor++;
+		}
+	}
+	
+	argSize = ASLogArgDefault;
+	switch (*cursor) {
+		case 'h':
+			argSize = (cursor[1] == 'h' ? ASLogArgChar : ASLogArgShort);
+			cursor += (argSize == ASLogArgChar ? 2 : 1);
+			break;
+		case 'l':
+			argSize = (cursor[1] == 'l' ? ASLogArgLongLong : ASLogArgLong);
+			cursor += (argSize == ASLogArgLongLong ? 2 : 1);
+			break;
+		case 'q': argSize = ASLogArgLongLong; cursor++; break;
+		case 'L': argSize = ASLogArgLongDouble; cursor++; break;
+		case 'z': argSize = ASLogArgSize; cursor++; break;
+		case 't': argSize = ASLogArgPtrDiff; cursor++; break;
+		case 'j': argSize = ASLogArgIntMax; cursor++; break;
+	}
+	
+	conversion = *cursor;
+	if (conversion == '\0') {
+		// an unfinished conversion at the end is logged as it stands
+		op->length = cursor - op->text;
+		return cursor;
+	}
+	cursor++;
+	
+	// the obsolete upper case forms of ld, lu and lo are still accepted by NSString
+	if (conversion == 'D' || conversion == 'U' || conversion == 'O') {
+		conversion = (char)(conversion - 'A' + 'a');
+		argSize = ASLogArgLong;
+	}
+	
+	switch (conversion) {
+		case '%':
+			// the first '%' becomes the end of the text
+			op->length++;
+			return cursor;
+			
+		case 'd':
+		case 'i':
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			op->spec[specLength++] = 'j';
+			break;
+			
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (argSize == ASLogArgLongDouble)
+				op->spec[specLength++] = 'L';
+			break;
+			
+		case 's':
+			if (argSize == ASLogArgLong)
+				op->spec[specLength++] = 'l';
+			break;
+			
+		case '@':
+		case 'c':
+		case 'C':
+		case 'S':
+		case 'p':
+		case 'n':
+			break;
+			
+		default:
+			// not a conversion we know, log it as it stands
+			op->length = cursor - op->text;
+			return cursor;
+	}
+	op->spec[specLength++] = conversion;
+	op->spec[specLength] = '\0';
+	op->conversion = conversion;
+	op->argSize = argSize;
+	return cursor;
+}
+
+
+/*!
+ @brief Runs one step of a parsed format: appends its text, then formats its 
+ conversion into the buffer.
+ 
+ Conversions are formatted directly into the buffer with vsnprintf() and %@ objects 
+ go through ASLogBufferAppendObject(). Plain %d, %u and %s, with no flags, width or 
+ precision, are copied without vsnprintf().
+ 
+ @param buffer - buffer to format into.
+ 
+ @param op - the step, from ASLogFormatParse().
+ 
+ @param ap - the arguments for the format, taken as they are used.
+ */
+static void ASLogFormatStep(ASLogBuffer *buffer, const ASLogFormatOp *op, va_list *ap)
+{
+	const char *spec = op->spec, *in;
+	char expanded[sizeof(op->spec) + 24], *out;
+	int value;
+	intmax_t signedValue;
+	uintmax_t unsignedValue;
+	const unichar *characters;
+	unichar character;
+	size_t count;
+	id object;
+	
+	ASLogBufferAppend(buffer, op->text, op->length);
+	if (op->stars != 0) {
+		// fill in the '*' width and precision from the arguments
+		for (in = op->spec, out = expanded; *in != '\0'; in++) {
+			if (*in != '*') {
+				*out++ = *in;
+				continue;
+			}
+			value = va_arg(*ap, int);
+			if (in[-1] == '.' && value < 0)
+				// a negative precision is taken as if it were omitted
+				out--;
+			else
+				out += snprintf(out, 12, "%d", value);
+		}
+		*out = '\0';
+		spec = expanded;
+	}
+	
+	switch (op->conversion) {
+		case '@':
+			object = va_arg(*ap, id);
+			if (!buffer->deferring || !ASLogBufferDefer(buffer, object))
+				ASLogBufferAppendObject(buffer, object, 0);
+			break;
+			
+		case 'd':
+		case 'i':
+			switch (op->argSize) {
+				case ASLogArgChar: signedValue = (signed char)va_arg(*ap, int); break;
+				case ASLogArgShort: signedValue = (short)va_arg(*ap, int); break;
+				case ASLogArgLong: signedValue = va_arg(*ap, long); break;
+				case ASLogArgLongLong: signedValue = va_arg(*ap, long long); break;
+				case ASLogArgSize: signedValue = va_arg(*ap, ssize_t); break;
+				case ASLogArgPtrDiff: signedValue = va_arg(*ap, ptrdiff_t); break;
+				case ASLogArgIntMax: signedValue = va_arg(*ap, intmax_t); break;
+				default: signedValue = va_arg(*ap, int); break;
+			}
+			if (spec[1] == 'j')
+				ASLogBufferAppendDecimal(buffer, (signedValue < 0 ? -(uintmax_t)signedValue : (uintmax_t)signedValue), signedValue < 0);
+			else
+				ASLogBufferAppendFormat(buffer, spec, signedValue);
+			break;
+			
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			switch (op->argSize) {
+				case ASLogArgChar: unsignedValue = (unsigned char)va_arg(*ap, unsigned int); break;
+				case ASLogArgShort: unsignedValue = (unsigned short)va_arg(*ap, unsigned int); break;
+				case ASLogArgLong: unsignedValue = va_arg(*ap, unsigned long); break;
+				case ASLogArgLongLong: unsignedValue = va_arg(*ap, unsigned long long); break;
+				case ASLogArgSize: unsignedValue = va_arg(*ap, size_t); break;
+				case ASLogArgPtrDiff: unsignedValue = (uintmax_t)va_arg(*ap, ptrdiff_t); break;
+				case ASLogArgIntMax: unsignedValue = va_arg(*ap, uintmax_t); break;
+				default: unsignedValue = va_arg(*ap, unsigned int); break;
+			}
+			if (spec[1] == 'j' && op->conversion == 'u')
+				ASLogBufferAppendDecimal(buffer, unsignedValue, NO);
+			else
+				ASLogBufferAppendFormat(buffer, spec, unsignedValue);
+			break;
+			
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (op->argSize == ASLogArgLongDouble)
+				ASLogBufferAppendFormat(buffer, spec, va_arg(*ap, long double));
+			else
+				ASLogBufferAppendFormat(buffer, spec, va_arg(*ap, double));
+			break;
+			
+		case 'c':
+			if (op->argSize == ASLogArgLong) {
+				character = (unichar)va_arg(*ap, wint_t);
+				ASLogBufferAppendCharacters(buffer, &character, 1);
+			} else {
+				ASLogBufferAppendFormat(buffer, spec, va_arg(*ap, int));
+			}
+			break;
+			
+		case 'C':
+			character = (unichar)va_arg(*ap, int);
+			ASLogBufferAppendCharacters(buffer, &character, 1);
+			break;
+			
+		case 's':
+			if (op->argSize == ASLogArgLong) {
+				ASLogBufferAppendFormat(buffer, spec, va_arg(*ap, wchar_t *));
+			} else if (spec[1] == 's') {
+				in = va_arg(*ap, const char *);
+				if (in == NULL)
+					in = "(null)";
+				ASLogBufferAppend(buffer, in, strlen(in));
+			} else {
+				ASLogBufferAppendFormat(buffer, spec, va_arg(*ap, char *));
+			}
+			break;
+			
+		case 'S':
+			characters = va_arg(*ap, const unichar *);
+			if (characters == NULL) {
+				ASLogBufferAppend(buffer, "(null)", 6);
+			} else {
+				for (count = 0; characters[count] != 0; count++)
+					;
+				ASLogBufferAppendCharacters(buffer, characters, count);
+			}
+			break;
+			
+		case 'p':
+			ASLogBufferAppendFormat(buffer, spec, va_arg(*ap, void *));
+			break;
+			
+		case 'n':
+			// never written through
+			(void)va_arg(*ap, void *);
+			break;
+	}
+}
+
+
+/*!
+ @brief Finds the parsed steps of a string literal format, parsing it the first time
+ it is seen.
+ 
+ Keyed on the literal's address, which stays the same and holds the same text for 
+ the life of the process. The steps point into a copy of the text kept with them. 
+ Lookups take no lock, entries are never removed.
+ 
+ @param key - address of the string literal, an NSString or a c-string.
+ 
+ @param format - the NSString literal, or nil if bytes is given.
+ 
+ @param bytes - the c-string literal, or NULL to take it from format.
+ 
+ @return the format's entry, or NULL if the cache is full.
+ */
+static ASLogFormatEntry *ASLogFormatFind(const void *key, NSString *format, const char *bytes)
+{
+	unsigned long hash = ((uintptr_t)key >> 3) * 2654435761UL;
+	ASLogFormatEntry *entry, *found = NULL;
+	ASLogFormatOp *ops;
+	const char *cursor;
+	const void *held;
+	char *text;
+	size_t length, size;
+	int probe, count = 1;
+	
+	for (probe = 0; probe < ASLogFormatProbeLimit; probe++) {
+		entry = &__sFormats[(hash + probe) & (ASLogFormatCacheSize - 1)];
+		// pairs with the release below, so the steps are seen along with the key
+		held = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+		if (held == key)
+			return entry;
+		if (held == NULL)
+			break;
+	}
+	if (probe == ASLogFormatProbeLimit)
+		return NULL;
+	
+	// no more steps than conversions, plus the text after the last one
+	if (bytes == NULL)
+		bytes = [format UTF8String];
+	if (bytes == NULL)
+		return NULL;
+	length = strlen(bytes);
+	for (cursor = bytes; (cursor = strchr(cursor, '%')) != NULL; cursor++)
+		count++;
+	size = count * sizeof(ASLogFormatOp) + length + 1;
+	if (!ASLogMemoryReserve(ASLogMemoryFormatCache, size))
+		return NULL;
+	ops = malloc(size);
+	if (ops == NULL) {
+		ASLogMemoryRelease(ASLogMemoryFormatCache, size);
+		return NULL;
+	}
+	text = (char *)(ops + count);
+	memcpy(text, bytes, length + 1);
+	for (cursor = text, count = 0; *cursor != '\0'; count++)
+		cursor = ASLogFormatParse(cursor, &ops[count]);
+	
+	pthread_mutex_lock(&__sFormatLock);
+	for (probe = 0; probe < ASLogFormatProbeLimit; probe++) {
+		entry = &__sFormats[(hash + probe) & (ASLogFormatCacheSize - 1)];
+		if (entry->key == key) {
+			// parsed by another thread in the meantime
+			found = entry;
+			break;
+		}
+		if (entry->key == NULL) {
+			entry->ops = ops;
+			entry->count = count;
+			entry->positional = ASLogFormatPositional(text);
+			__atomic_store_n(&entry->key, key, __ATOMIC_RELEASE);
+			found = entry;
+			ops = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&__sFormatLock);
+	if (ops != NULL) {
+		free(ops);
+		ASLogMemoryRelease(ASLogMemoryFormatCache, size);
+	}
+	return found;
+}
+
+
+/*!
+ @brief Finds the parsed steps of a format, see ASLogFormatFind().
+ 
+ Only string literals are cached. Other formats could be freed and their address 
+ reused for different text.
+ 
+ @param format - the format.
+ 
+ @return the format's entry, or NULL if it is not cached.
+ */
+static ASLogFormatEntry *ASLogFormatLookup(NSString *format)
+{
+	if ([format class] != __sConstantStringClass)
+		return NULL;
+	return ASLogFormatFind(format, format, NULL);
+}
+
+
+/*!
+ @brief Finishes a message: marks it if it was cut short, and terminates it.
+ 
+ A message that still has %@ arguments left in it is not marked yet, that is done 
+ once their text is filled in, see ASLogBufferExpand().
+ 
+ @param buffer - buffer the message was formatted into.
+ */
+static void ASLogBufferFinish(ASLogBuffer *buffer)
+{
+	size_t start, need;
+	unsigned char lead;
+	
+	// capacity always leaves room for the marker and the NUL
+	if (buffer->truncated) {
+		// a %s cut off by vsnprintf() may have left part of a UTF-8 character behind
+		for (start = buffer->length; start > 0 && buffer->length - start < 3; start--)
+			if (((unsigned char)buffer->bytes[start - 1] & 0xc0) != 0x80)
+				break;
+		if (start > 0) {
+			lead = (unsigned char)buffer->bytes[start - 1];
+			need = (lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : lead >= 0xc0 ? 2 : 1);
+			if (buffer->length - (start - 1) < need)
+				buffer->length = start - 1;
+		}
+	}
+	if (buffer->truncated && buffer->objectCount == 0) {
+		memcpy(buffer->bytes + buffer->length, __sTruncationMarker, sizeof(__sTruncationMarker) - 1);
+		buffer->length += sizeof(__sTruncationMarker) - 1;
+	}
+	buffer->bytes[buffer->length] = '\0';
+}
+
+
+/*!
+ @brief Appends a finished message's trailer, a backtrace, past its capacity.
+ 
+ @param buffer - buffer holding a finished message.
+ 
+ @param bytes - the trailer, at most ASLogBacktraceReserve bytes.
+ 
+ @param length - length of the trailer.
+ */
+static void ASLogBufferAppendTrailer(ASLogBuffer *buffer, const char *bytes, size_t length)
+{
+	memcpy(buffer->bytes + buffer->length, bytes, length);
+	buffer->length += length;
+	buffer->trailer = length;
+	buffer->bytes[buffer->length] = '\0';
+}
+
+
+/*!
+ @brief Formats a message whose %@ arguments were left for later into a buffer, 
+ filling in their text, and terminates it.
+ 
+ The arguments are appended as ASLogBufferAppendObject() would have and released. 
+ The message is cut short at the buffer's capacity like any other, see 
+ ASLogBufferFinish().
+ 
+ @param buffer - buffer to format into, from ASLogBufferAcquire().
+ 
+ @param bytes - the message without the arguments' text.
+ 
+ @param length - length of the message.
+ 
+ @param objects - the arguments, in order, with where their text goes in bytes.
+ 
+ @param count - number of arguments.
+ 
+ @param truncated - YES if the message was cut short before the arguments were left.
+ 
+ @param trailer - bytes at the end of bytes past the message, a backtrace, appended 
+ whole after it in the room capacity leaves.
+ */
+static void ASLogBufferExpand(ASLogBuffer *buffer, const char *bytes, size_t length, 
+							  const ASLogDeferredObject *objects, int count, BOOL truncated, size_t trailer)
+{
+	size_t done = 0;
+	int i;
+	
+	for (i = 0; i < count; i++) {
+		ASLogBufferAppend(buffer, bytes + done, objects[i].offset - done);
+		done = objects[i].offset;
+		if (!buffer->truncated)
+			ASLogBufferAppendObject(buffer, objects[i].object, 0);
+		[objects[i].object release];
+	}
+	ASLogBufferAppend(buffer, bytes + done, length - trailer - done);
+	if (truncated)
+		buffer->truncated = YES;
+	ASLogBufferFinish(buffer);
+	ASLogBufferAppendTrailer(buffer, bytes + length - trailer, trailer);
+}
+
+
+/*!
+ @brief Fills in the %@ arguments a message left within its own buffer, for when no
+ second buffer can be had to expand it into with ASLogBufferExpand().
+ 
+ The message is rebuilt as an NSString, with -description for each argument, and 
+ appended back into the buffer, so it is cut short at the same capacity. The trailer
+ is kept whole.
+ 
+ @param buffer - the message, with the arguments it left.
+ */
+static void ASLogBufferExpandInPlace(ASLogBuffer *buffer)
+{
+	NSMutableString *line = [[NSMutableString alloc] init];
+	NSString *piece, *description;
+	BOOL truncated = buffer->truncated;
+	size_t done = 0, offset, trailer = buffer->trailer;
+	char saved[ASLogBacktraceReserve];
+	id object;
+	int i;
+	
+	// the trailer is put back whole once the message is rebuilt over it
+	memcpy(saved, buffer->bytes + buffer->length - trailer, trailer);
+	for (i = 0; i <= buffer->objectCount; i++) {
+		offset = (i < buffer->objectCount ? buffer->objects[i].offset : buffer->length - trailer);
+		piece = [[NSString alloc] initWithBytes:buffer->bytes + done length:offset - done 
+									   encoding:NSUTF8StringEncoding];
+		if (piece == nil)
+			piece = [[NSString alloc] initWithBytes:buffer->bytes + done length:offset - done 
+										   encoding:NSISOLatin1StringEncoding];
+		if (piece != nil)
+			[line appendString:piece];
+		[piece release];
+		done = offset;
+		if (i < buffer->objectCount) {
+			object = buffer->objects[i].object;
+			description = [object description];
+			[line appendString:(description != nil ? description : @"(null)")];
+			[object release];
+		}
+	}
+	buffer->objectCount = 0;
+	buffer->length = 0;
+	buffer->truncated = NO;
+	ASLogBufferAppendString(buffer, line);
+	[line release];
+	if (truncated)
+		buffer->truncated = YES;
+	ASLogBufferFinish(buffer);
+	ASLogBufferAppendTrailer(buffer, saved, trailer);
+}
+
+
+/*!
+ @brief Formats an NSLog() style format and arguments into a buffer, stopping early
+ once the buffer is full, and terminates it.
+ 
+ The format is walked a step at a time, see ASLogFormatParse() and 
+ ASLogFormatStep(), rather than handed to -initWithFormat:arguments: so that nothing 
+ past the buffer's capacity is ever generated. String literal formats are only parsed
+ the first time, see ASLogFormatLookup(). Formats with positional (%n$) arguments 
+ still go to -initWithFormat:arguments: and the result is truncated. The message is
+ finished off by ASLogBufferFinish().
+ 
+ @param buffer - buffer to format into, from ASLogBufferAcquire().
+ 
+ @param format - NSString * that holds the formatting string (vide NSLog()).
+ 
+ @param ap - the arguments for format.
+ */
+static void ASLogFormatV(ASLogBuffer *buffer, NSString *format, va_list ap)
+{
+	ASLogFormatEntry *entry = ASLogFormatLookup(format);
+	const char *bytes;
+	NSString *print;
+	ASLogFormatOp op;
+	va_list args;
+	int i;
+	
+	va_copy(args, ap);
+	if (entry != NULL && !entry->positional) {
+		for (i = 0; i < entry->count && !buffer->truncated; i++)
+			ASLogFormatStep(buffer, &entry->ops[i], &args);
+	} else if ((bytes = [format UTF8String]) != NULL && ASLogFormatPositional(bytes)) {
+		print = [[NSString alloc] initWithFormat:format arguments:args];
+		ASLogBufferAppendString(buffer, print);
+		[print release];
+	} else if (bytes != NULL) {
+		while (*bytes != '\0' && !buffer->truncated) {
+			bytes = ASLogFormatParse(bytes, &op);
+			ASLogFormatStep(buffer, &op, &args);
+		}
+	}
+	va_end(args);
+	ASLogBufferFinish(buffer);
+}
+
+
+/*!
+ @brief Gives an argument of the C logging macros as an integer, whatever its type.
+ 
+ @param type - the argument's character in the call site's signature.
+ 
+ @param value - the argument.
+ */
+static intmax_t ASLogCInteger(char type, ASLogCValue value)
+{
+	switch (type) {
+		case 'i': return value.i;
+		case 'u': return (intmax_t)value.u;
+		case 'd': return (intmax_t)value.d;
+		default: return (intmax_t)(intptr_t)value.p;
+	}
+}
+
+
+/*!
+ @brief Appends a single conversion to a buffer from the arguments of the C logging 
+ macros, stopping at its capacity.
+ 
+ Works like ASLogFormatStep(), but each argument is taken from values and converted
+ from the type the call site's signature gives it to what the conversion needs. A 
+ string conversion of anything but a c-string logs it as a pointer. A conversion 
+ with no argument left is left out.
+ 
+ @param buffer - buffer to append to.
+ 
+ @param op - the step.
+ 
+ @param site - the call site.
+ 
+ @param values - the arguments.
+ 
+ @param next - index of the next argument, moved past those used.
+ */
+static void ASLogCFormatStep(ASLogBuffer *buffer, const ASLogFormatOp *op, const ASLogCSite *site, 
+							 const ASLogCValue *values, int *next)
+{
+	const char *spec = op->spec, *in;
+	char expanded[sizeof(op->spec) + 24], *out;
+	intmax_t signedValue;
+	uintmax_t unsignedValue;
+	double doubleValue;
+	ASLogCValue value;
+	unichar character;
+	char type;
+	int width;
+	
+	ASLogBufferAppend(buffer, op->text, op->length);
+	if (op->stars != 0) {
+		// fill in the '*' width and precision from the arguments
+		for (in = op->spec, out = expanded; *in != '\0'; in++) {
+			if (*in != '*') {
+				*out++ = *in;
+				continue;
+			}
+			width = 0;
+			if (*next < site->count) {
+				width = (int)ASLogCInteger(site->signature[*next], values[*next]);
+				(*next)++;
+			}
+			if (in[-1] == '.' && width < 0)
+				// a negative precision is taken as if it were omitted
+				out--;
+			else
+				out += snprintf(out, 12, "%d", width);
+		}
+		*out = '\0';
+		spec = expanded;
+	}
+	if (op->conversion == 0 || *next >= site->count)
+		return;
+	type = site->signature[*next];
+	value = values[(*next)++];
+	signedValue = ASLogCInteger(type, value);
+	
+	switch (op->conversion) {
+		case 'd':
+		case 'i':
+			switch (op->argSize) {
+				case ASLogArgChar: signedValue = (signed char)signedValue; break;
+				case ASLogArgShort: signedValue = (short)signedValue; break;
+				case ASLogArgDefault: signedValue = (int)signedValue; break;
+				case ASLogArgLong: signedValue = (long)signedValue; break;
+			}
+			if (spec[1] == 'j')
+				ASLogBufferAppendDecimal(buffer, (signedValue < 0 ? -(uintmax_t)signedValue : (uintmax_t)signedValue), signedValue < 0);
+			else
+				ASLogBufferAppendFormat(buffer, spec, signedValue);
+			break;
+			
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			unsignedValue = (type == 'u' ? value.u : (uintmax_t)signedValue);
+			switch (op->argSize) {
+				case ASLogArgChar: unsignedValue = (unsigned char)unsignedValue; break;
+				case ASLogArgShort: unsignedValue = (unsigned short)unsignedValue; break;
+				case ASLogArgDefault: unsignedValue = (unsigned int)unsignedValue; break;
+				case ASLogArgLong: unsignedValue = (unsigned long)unsignedValue; break;
+			}
+			if (spec[1] == 'j' && op->conversion == 'u')
+				ASLogBufferAppendDecimal(buffer, unsignedValue, NO);
+			else
+				ASLogBufferAppendFormat(buffer, spec, unsignedValue);
+			break;
+			
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			doubleValue = (type == 'd' ? value.d : type == 'u' ? (double)value.u : (double)signedValue);
+			if (op->argSize == ASLogArgLongDouble)
+				ASLogBufferAppendFormat(buffer, spec, (long double)doubleValue);
+			else
+				ASLogBufferAppendFormat(buffer, spec, doubleValue);
+			break;
+			
+		case 'c':
+			if (op->argSize == ASLogArgLong) {
+				character = (unichar)signedValue;
+				ASLogBufferAppendCharacters(buffer, &character, 1);
+			} else {
+				ASLogBufferAppendFormat(buffer, spec, (int)signedValue);
+			}
+			break;
+			
+		case 'C':
+			character = (unichar)signedValue;
+			ASLogBufferAppendCharacters(buffer, &character, 1);
+			break;
+			
+		case 's':
+		case 'S':
+			if (type != 's') {
+				ASLogBufferAppendFormat(buffer, "%p", value.p);
+			} else if (spec[1] == 's' || op->conversion == 'S' || op->argSize == ASLogArgLong) {
+				in = (value.s != NULL ? value.s : "(null)");
+				ASLogBufferAppend(buffer, in, strlen(in));
+			} else {
+				ASLogBufferAppendFormat(buffer, spec, value.s);
+			}
+			break;
+			
+		case 'p':
+			ASLogBufferAppendFormat(buffer, spec, value.p);
+			break;
+			
+		case '@':
+			// there are no objects in C
+			ASLogBufferAppendFormat(buffer, "%p", value.p);
+			break;
+	}
+}
+
+
+/*!
+ @brief Formats the format and arguments of a C logging macro call site into a 
+ buffer, stopping early once the buffer is full, and terminates it.
+ 
+ The format, a string literal, is parsed the first time only, see ASLogFormatFind().
+ 
+ @param buffer - buffer to format into, from ASLogBufferAcquire().
+ 
+ @param site - the call site.
+ 
+ @param values - its arguments, as many as the site has.
+ */
+static void ASLogCFormat(ASLogBuffer *buffer, const ASLogCSite *site, const ASLogCValue *values)
+{
+	ASLogFormatEntry *entry = ASLogFormatFind(site->format, nil, site->format);
+	const char *cursor = site->format;
+	ASLogFormatOp op;
+	int i, next = 0;
+	
+	if (entry != NULL) {
+		for (i = 0; i < entry->count && !buffer->truncated; i++)
+			ASLogCFormatStep(buffer, &entry->ops[i], site, values, &next);
+	} else {
+		while (*cursor != '\0' && !buffer->truncated) {
+			cursor = ASLogFormatParse(cursor, &op);
+			ASLogCFormatStep(buffer, &op, site, values, &next);
+		}
+	}
+	ASLogBufferFinish(buffer);
+}
+
+
+/*!
+ @brief Wraps the text in a buffer in an NSString without copying it.
+ 
+ The text is normally UTF-8, but %s arguments may have put other bytes in it, in which
+ case it is taken as Latin-1.
+ 
+ @param buffer - the formatted buffer.
+ 
+ @return NSString *, which the caller must release before releasing the buffer.
+ */
+static NSString *ASLogBufferCopyString(ASLogBuffer *buffer)
+{
+	NSString *print;
+	
+	print = [[NSString alloc] initWithBytesNoCopy:buffer->bytes length:buffer->length 
+										 encoding:NSUTF8StringEncoding freeWhenDone:NO];
+	if (print == nil)
+		print = [[NSString alloc] initWithBytesNoCopy:buffer->bytes length:buffer->length 
+											 encoding:NSISOLatin1StringEncoding freeWhenDone:NO];
+	return print;
+}
+
+#pragma mark Formatters
+
+/*!
+ @brief Appends bytes of UTF-8 text to a log message, see ASLogFormattable.
+ 
+ @param buffer - the message being built.
+ 
+ @param bytes - the text.
+ 
+ @param length - number of bytes.
+ */
+void ASLogAppendBytes(ASLogBuffer *buffer, const char *bytes, size_t length)
+{
+	ASLogBufferAppend(buffer, bytes, length);
+}
+
+
+/*!
+ @brief Appends a NUL terminated c-string to a log message, see ASLogFormattable.
+ */
+void ASLogAppendCString(ASLogBuffer *buffer, const char *string)
+{
+	if (string == NULL)
+		string = "(null)";
+	ASLogBufferAppend(buffer, string, strlen(string));
+}
+
+
+/*!
+ @brief Appends an NSString to a log message, see ASLogFormattable.
+ */
+void ASLogAppendString(ASLogBuffer *buffer, NSString *string)
+{
+	if (string == nil)
+		ASLogBufferAppend(buffer, "(null)", 6);
+	else
+		ASLogBufferAppendString(buffer, string);
+}
+
+
+/*!
+ @brief Appends a signed number in decimal to a log message, see ASLogFormattable.
+ */
+void ASLogAppendInteger(ASLogBuffer *buffer, long long value)
+{
+	ASLogBufferAppendDecimal(buffer, (value < 0 ? -(uintmax_t)value : (uintmax_t)value), value < 0);
+}
+
+
+/*!
+ @brief Appends an unsigned number in decimal to a log message, see ASLogFormattable.
+ */
+void ASLogAppendUnsigned(ASLogBuffer *buffer, unsigned long long value)
+{
+	ASLogBufferAppendDecimal(buffer, value, NO);
+}
+
+
+/*!
+ @brief Appends a floating point number, as %g would, to a log message, see 
+ ASLogFormattable.
+ */
+void ASLogAppendDouble(ASLogBuffer *buffer, double value)
+{
+	ASLogBufferAppendFormat(buffer, "%g", value);
+}
+
+
+/*!
+ @brief Appends an object to a log message as %@ would, see ASLogFormattable.
+ 
+ For an object a formatter holds, such as a member of a model object. It counts as
+ nested one level deeper than the object holding it.
+ */
+void ASLogAppendObject(ASLogBuffer *buffer, id object)
+{
+	if (buffer->depth >= 8) {		// an object holding itself
+		ASLogBufferAppend(buffer, "...", 3);
+		return;
+	}
+	ASLogBufferAppendObject(buffer, object, buffer->depth + 1);
+}
+
+
+/*!
+ @brief Tells a formatter that nothing more fits in a log message, see 
+ ASLogFormattable.
+ 
+ @return YES once the message has been cut short, anything appended is then ignored.
+ */
+BOOL ASLogBufferFull(ASLogBuffer *buffer)
+{
+	return buffer->truncated;
+}
+
+#pragma mark Backtraces
+
+/*!
+ @brief Writes an address as 0x followed by a fixed number of hex digits.
+ 
+ @param out - buffer to write to, must have room for 2 + 2 * sizeof(void *) chars.
+ 
+ @param address - the address.
+ 
+ @return pointer to the char after the last one written.
+ */
+static char *ASLogHexAddress(char *out, uintptr_t address)
+{
+	int shift;
+	
+	*out++ = '0';
+	*out++ = 'x';
+	for (shift = (int)(sizeof(uintptr_t) * 8) - 4; shift >= 0; shift -= 4)
+		*out++ = __sHexDigits[(address >> shift) & 0x0f];
+	return out;
+}
+
+
+/*!
+ @brief Appends raw return addresses to a formatted, terminated buffer.
+ 
+ Written into the space ASLogBacktraceReserve keeps past the message, so a backtrace 
+ is never lost to truncation, and counted as the buffer's trailer so that it is kept
+ whole when the message's %@ arguments are filled in. The addresses are not 
+ symbolized, see ASLogOutputImageMap().
+ 
+ @param buffer - buffer holding a message finished by ASLogFormatV().
+ 
+ @param frames - return addresses from backtrace().
+ 
+ @param count - number of addresses, at most ASLogBacktraceDepth.
+ */
+static void ASLogBufferAppendBacktrace(ASLogBuffer *buffer, void **frames, int count)
+{
+	char *out = buffer->bytes + buffer->length;
+	int i;
+	
+	memcpy(out, "\n\tbacktrace:", 12);
+	out += 12;
+	for (i = 0; i < count; i++) {
+		*out++ = ' ';
+		out = ASLogHexAddress(out, (uintptr_t)frames[i]);
+	}
+	*out = '\0';
+	buffer->trailer += out - (buffer->bytes + buffer->length);
+	buffer->length = out - buffer->bytes;
+}
+
+
+#if !defined(__APPLE__)
+/*!
+ @brief dl_iterate_phdr() callback counting the loaded images.
+ */
+static int ASLogImageCountCallback(struct dl_phdr_info *info, size_t size, void *context)
+{
+	(*(unsigned long *)context)++;
+	return 0;
+}
+
+
+/*!
+ @brief dl_iterate_phdr() callback logging one loaded image.
+ 
+ The main executable has no name here so its path is read from /proc.
+ */
+static int ASLogImageMapCallback(struct dl_phdr_info *info, size_t size, void *context)
+{
+	char path[PATH_MAX + 1];
+	const char *name = info->dlpi_name;
+	ssize_t length;
+	
+	if (name == NULL || name[0] == '\0') {
+		length = readlink("/proc/self/exe", path, PATH_MAX);
+		path[(length < 0 ? 0 : length)] = '\0';
+		name = path;
+	}
+	__sCurLogFunc(@"ASLog image: %p %s", (void *)info->dlpi_addr, name);
+	return 0;
+}
+#endif
+
+
+/*!
+ @brief Logs the load address and path of every loaded image, if they have changed.
+ 
+ Backtraces are logged as raw addresses because symbolizing them in-process with 
+ backtrace_symbols() is slow and allocates. With this map an offline tool 
+ (Tools/aslog-symbolize) can turn them into symbols using the binaries and their debug 
+ info. The map is only logged before the first backtrace and again whenever the 
+ number of loaded images has changed.
+ 
+ On Linux the address given is the load bias (addr2line wants the address minus the
+ bias), on macOS it is the Mach-O header (as atos -l wants).
+ */
+static void ASLogOutputImageMap(void)
+{
+	unsigned long count = 0;
+#if defined(__APPLE__)
+	unsigned long i;
+	
+	count = _dyld_image_count();
+#else
+	dl_iterate_phdr(ASLogImageCountCallback, &count);
+#endif
+	if (count == __sImageMapCount)
+		return;
+	__sImageMapCount = count;
+	
+	__sCurLogFunc(@"ASLog image map: %lu images", count);
+#if defined(__APPLE__)
+	for (i = 0; i < count; i++)
+		__sCurLogFunc(@"ASLog image: %p %s", (void *)_dyld_get_image_header((uint32_t)i), _dyld_get_image_name((uint32_t)i));
+#else
+	dl_iterate_phdr(ASLogImageMapCallback, NULL);
+#endif
+}
+
+#pragma mark Throttling
+
+/*!
+ @brief Finds, or adds, the rate record for a call site.
+ 
+ Lookups are lock free. A new site's line is written before its key is published, so
+ a reader that sees the key sees the right line.
+ 
+ @param key - the __FILE__ pointer, or the format pointer for unadorned methods.
+ 
+ @param line - the __LINE__, or 0 if key is the format.
+ 
+ @return the site's record, or NULL if the table has no room for it.
+ */
+static ASLogSite *ASLogSiteFind(const void *key, int line)
+{
+	unsigned long hash = (((uintptr_t)key >> 3) ^ ((unsigned long)line * 2654435761UL));
+	ASLogSite *site;
+	int probe;
+	
+	for (probe = 0; probe < ASLogSiteProbeLimit; probe++) {
+		site = &__sSites[(hash + probe) & (ASLogSiteTableSize - 1)];
+		if (site->key == key && site->line == line)
+			return site;
+		if (site->key != NULL)
+			continue;
+		
+		pthread_mutex_lock(&__sSiteLock);
+		if (site->key == NULL) {
+			site->line = line;
+			__sync_synchronize();
+			site->key = key;
+		}
+		pthread_mutex_unlock(&__sSiteLock);
+		if (site->key == key && site->line == line)
+			return site;
+	}
+	return NULL;
+}
+
+
+/*!
+ @brief Logs a notice that a call site has been throttled or is no longer throttled.
+ 
+ Output as a line of its own, see ASLogNotice(), it is not itself throttled.
+ */
+static void ASLogSiteNotice(ASLogSite *site, BOOL throttled, unsigned long count)
+{
+	if (throttled && site->line == 0)
+		ASLogNotice(@"ASLog: \"%@\" logged more than %lu lines in a second, logging 1 in %lu until it slows down",
+					(NSString *)site->key, (unsigned long)__sSiteRateLimit, (unsigned long)__sThrottledSampleRate);
+	else if (throttled)
+		ASLogNotice(@"ASLog: %s:%d logged more than %lu lines in a second, logging 1 in %lu until it slows down",
+					ASLogBaseName(site->key), site->line, (unsigned long)__sSiteRateLimit, (unsigned long)__sThrottledSampleRate);
+	else if (site->line == 0)
+		ASLogNotice(@"ASLog: \"%@\" no longer throttled, %lu lines were not logged", (NSString *)site->key, count);
+	else
+		ASLogNotice(@"ASLog: %s:%d no longer throttled, %lu lines were not logged", ASLogBaseName(site->key), site->line, count);
+}
+
+
+/*!
+ @brief Counts a line from a call site and decides whether it is logged.
+ 
+ Each site counts its lines per second. Once it passes __sSiteRateLimit in a second 
+ it is throttled: only every __sThrottledSampleRate'th line is logged and a notice 
+ says so. The first line in a later second closes the previous window, if that 
+ window stayed under the limit (or the site went quiet) the site logs everything 
+ again and a notice gives the number of lines dropped.
+ 
+ Counting uses atomic operations only, whichever thread moves a site's window on 
+ evaluates the window it closed.
+ 
+ @param key - the __FILE__ pointer, or for unadorned methods the format pointer, only 
+ if the format is a string literal. Lines with no key are not throttled.
+ 
+ @param line - the __LINE__, or 0 if key is the format.
+ 
+ @return YES if the line should be logged.
+ */
+static BOOL ASLogSiteAllows(const void *key, int line)
+{
+	ASLogSite *site;
+	long now, window;
+	unsigned long count;
+	
+	if (__sSiteRateLimit == 0 || key == NULL || (site = ASLogSiteFind(key, line)) == NULL)
+		return YES;
+	
+	now = (long)time(NULL);
+	window = site->window;
+	if (window != now && __sync_bool_compare_and_swap(&site->window, window, now)) {
+		count = __sync_lock_test_and_set(&site->count, 0);
+		if (site->throttled && (window != now - 1 || count <= __sSiteRateLimit)) {
+			site->throttled = 0;
+			ASLogSiteNotice(site, NO, __sync_lock_test_and_set(&site->suppressed, 0));
+		}
+	}
+	
+	count = __sync_add_and_fetch(&site->count, 1);
+	if (!site->throttled) {
+		if (count <= __sSiteRateLimit)
+			return YES;
+		if (__sync_bool_compare_and_swap(&site->throttled, 0, 1))
+			ASLogSiteNotice(site, YES, 0);
+	}
+	if (__sThrottledSampleRate <= 1 || count % __sThrottledSampleRate == 0)
+		return YES;
+	__sync_fetch_and_add(&site->suppressed, 1);
+	return NO;
+}
+
+#pragma mark Load shedding
+
+/*!
+ @brief Monotonic clock in microseconds, for timing output.
+ */
+static uint64_t ASLogNow(void)
+{
+#if defined(__APPLE__)
+	static mach_timebase_info_data_t timebase;
+	
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom / 1000;
+#else
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+
+/*!
+ @brief Decides whether a line survives load shedding.
+ 
+ Lines below the shed level are dropped, except that one is let through each second 
+ so that the output latency is still measured, and shedding can be undone, when 
+ nothing else is being written.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @return YES if the line should be logged.
+ */
+static BOOL ASLogShedAllows(ASLogLevel level)
+{
+	uint64_t probe, now;
+	
+	if ((int)level >= __sShedLevel)
+		return YES;
+	probe = __sShedProbe;
+	now = ASLogNow();
+	if (now - probe >= 1000000 && __sync_bool_compare_and_swap(&__sShedProbe, probe, now))
+		return YES;
+	__sync_fetch_and_add(&__sShedDropped, 1);
+	return NO;
+}
+
+
+/*!
+ @brief Records how long a line took to output and steps shedding up or down.
+ 
+ Keeps a moving average of output latency. At most once a second: if the average is 
+ above __sShedLatency, or in asynchronous mode the bulk lane is more than three 
+ quarters full, one more level is shed. If the average is below half of it, and the
+ bulk lane less than a quarter full, one level is restored. Each step is announced 
+ with a notice, see ASLogNotice().
+ 
+ @param start - ASLogNow() from before the line was output.
+ */
+static void ASLogShedRecord(uint64_t start)
+{
+	uint64_t now = ASLogNow(), checked = __sShedChecked, average;
+	size_t backlog = 0, used;
+	int i;
+	static const char *levelNames[] = { "debug", "normal" };
+	
+	// a torn or lost update of the average does no harm
+	average = __sWriteLatency = (__sWriteLatency * 7 + (now - start)) / 8;
+	if (__sShedLatency == 0 || now - checked < 1000000 || !__sync_bool_compare_and_swap(&__sShedChecked, checked, now))
+		return;
+	
+	// percentage of the fullest bulk lane in use, read without the lock
+	for (i = 0; __sAsyncOn && i < __sBulkLaneCount; i++) {
+		if (__sBulkLanes[i].size == 0)
+			continue;
+		used = (__sBulkLanes[i].head - __sBulkLanes[i].tail) * 100 / __sBulkLanes[i].size;
+		if (used > backlog)
+			backlog = used;
+	}
+	
+	if ((average > __sShedLatency || backlog > 75) && __sShedLevel < ASLogLevelWarning) {
+		ASLogNotice(@"ASLog: output is slow (%.1f ms a line), dropping %s lines",
+					average / 1000.0, levelNames[__sShedLevel]);
+		__sShedLevel++;
+	} else if (average < __sShedLatency / 2 && backlog < 25 && __sShedLevel > 0) {
+		__sShedLevel--;
+		ASLogNotice(@"ASLog: output has recovered (%.1f ms a line), logging %s lines again, %lu lines were dropped",
+					average / 1000.0, levelNames[__sShedLevel], __sync_lock_test_and_set(&__sShedDropped, 0));
+	}
+}
+
+#pragma mark Record pools
+
+/*!
+ @brief Frees a pool's free list, giving its memory back to the budget.
+ 
+ Called on the owning thread, or by whoever drops the last reference.
+ */
+static void ASLogPoolTrim(ASLogPool *pool)
+{
+	ASLogRecord *record;
+	
+	while ((record = pool->free) != NULL) {
+		pool->free = record->next;
+		ASLogMemoryRelease(ASLogMemoryRecordPools, record->capacity);
+		free(record);
+	}
+}
+
+
+/*!
+ @brief Moves the records the writer thread has handed back onto the free list.
+ */
+static void ASLogPoolCollect(ASLogPool *pool)
+{
+	ASLogRecord *record = __sync_lock_test_and_set(&pool->returned, NULL), *next;
+	
+	for (; record != NULL; record = next) {
+		next = record->next;
+		record->next = pool->free;
+		pool->free = record;
+	}
+}
+
+
+/*!
+ @brief Drops a reference to a pool, freeing it with the last one.
+ */
+static void ASLogPoolUnreference(ASLogPool *pool)
+{
+	ASLogPool **link;
+	
+	if (__sync_sub_and_fetch(&pool->references, 1) == 0) {
+		pthread_mutex_lock(&__sPoolLock);
+		for (link = &__sPools; *link != NULL; link = &(*link)->next) {
+			if (*link == pool) {
+				*link = pool->next;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&__sPoolLock);
+		ASLogPoolCollect(pool);
+		ASLogPoolTrim(pool);
+		free(pool);
+	}
+}
+
+
+/*!
+ @brief pthread key destructor for a thread's pool.
+ 
+ Frees what it can now. Records still queued keep the pool alive until the writer 
+ thread hands them back.
+ */
+static void ASLogPoolOrphan(void *context)
+{
+	ASLogPool *pool = context;
+	
+	ASLogPoolCollect(pool);
+	ASLogPoolTrim(pool);
+	ASLogPoolUnreference(pool);
+}
+
+
+/*!
+ @brief Allocates a record against the budget.
+ 
+ @return the record, or NULL if it would take the pools over __sPoolBudget, or ASLog
+ over __sMemoryBudget.
+ */
+static ASLogRecord *ASLogRecordAllocate(ASLogPool *pool, size_t capacity)
+{
+	ASLogRecord *record;
+	
+	if (__sMemoryUsed[ASLogMemoryRecordPools] + capacity > __sPoolBudget
+		|| !ASLogMemoryReserve(ASLogMemoryRecordPools, capacity))
+		return NULL;
+	record = malloc(sizeof(ASLogRecord) + capacity);
+	if (record == NULL) {
+		ASLogMemoryRelease(ASLogMemoryRecordPools, capacity);
+		return NULL;
+	}
+	record->pool = pool;
+	record->capacity = capacity;
+	return record;
+}
+
+
+/*!
+ @brief Takes a record big enough for a line from the calling thread's pool.
+ 
+ Reuses a free record if one is big enough, otherwise allocates one, first freeing 
+ the thread's smaller records if that is what it takes to stay within the budget.
+ 
+ @param length - size of the line.
+ 
+ @return the record, or NULL if the budget is spent or the pools are off.
+ */
+static ASLogRecord *ASLogPoolTake(size_t length)
+{
+	ASLogPool *pool;
+	ASLogRecord *record, **link;
+	size_t capacity = (length + ASLogRecordGranule - 1) / ASLogRecordGranule * ASLogRecordGranule;
+	
+	if (__sPoolBudget == 0)
+		return NULL;
+	pool = pthread_getspecific(__sPoolKey);
+	if (pool == NULL) {
+		pool = calloc(1, sizeof(ASLogPool));
+		if (pool == NULL)
+			return NULL;
+		pool->references = 1;
+		pthread_setspecific(__sPoolKey, pool);
+		pthread_mutex_lock(&__sPoolLock);
+		pool->next = __sPools;
+		__sPools = pool;
+		pthread_mutex_unlock(&__sPoolLock);
+	}
+	
+	ASLogPoolCollect(pool);
+	for (link = &pool->free; (record = *link) != NULL; link = &record->next) {
+		if (record->capacity >= length) {
+			*link = record->next;
+			break;
+		}
+	}
+	if (record == NULL) {
+		record = ASLogRecordAllocate(pool, capacity);
+		if (record == NULL && pool->free != NULL) {
+			ASLogPoolTrim(pool);
+			record = ASLogRecordAllocate(pool, capacity);
+		}
+		if (record == NULL)
+			return NULL;
+	}
+	__sync_fetch_and_add(&pool->references, 1);
+	record->next = NULL;
+	record->length = 0;
+	record->deferred = NULL;
+	record->objectCount = 0;
+	record->site = NULL;
+	return record;
+}
+
+
+/*!
+ @brief Hands a record back to the pool it came from, on any thread.
+ 
+ A deferred message's block, and any %@ arguments not yet written, are released.
+ */
+static void ASLogPoolReturn(ASLogRecord *record)
+{
+	ASLogPool *pool = record->pool;
+	ASLogRecord *head;
+	int i;
+	
+	for (i = 0; i < record->objectCount; i++)
+		[record->objects[i].object release];
+#if defined(__BLOCKS__)
+	if (record->deferred != NULL)
+		Block_release(record->deferred);
+#endif
+	do {
+		head = pool->returned;
+		record->next = head;
+	} while (!__sync_bool_compare_and_swap(&pool->returned, head, record));
+	ASLogPoolUnreference(pool);
+}
+
+#pragma mark Prefix patterns
+
+/*!
+ @brief Compiles a prefix pattern into the operations that render it.
+ 
+ Text is copied as it stands, %% for a '%'. The conversions are %T (date and time), 
+ %L (level name), %W ("WARNING: " on warnings only), %t (thread ID), %f (source file),
+ %l (line number), %F (method/function) and %m (the message). Text between %[ and %] 
+ is left out of lines that do not have a source file or function used inside it. 
+ Without %m the message follows the pattern.
+ 
+ @param pattern - c-string holding the pattern.
+ 
+ @return the program, to be freed with free(), or NULL if the pattern is not valid.
+ */
+static ASLogPrefixProgram *ASLogPrefixCompile(const char *pattern)
+{
+	size_t length = strlen(pattern);
+	size_t size = sizeof(ASLogPrefixProgram) + (length + 1) * sizeof(ASLogPrefixOp) + 2 * (length + 1);
+	ASLogPrefixProgram *program;
+	ASLogPrefixOp *op, *literal = NULL, *section = NULL;
+	char *text;
+	int opcode, needs;
+	
+	// no more operations than pattern characters, plus the message
+	program = calloc(1, size);
+	if (program == NULL)
+		return NULL;
+	text = (char *)(program->ops + length + 1);
+	program->size = size;
+	program->pattern = memcpy(text + length + 1, pattern, length + 1);
+	program->message = -1;
+	
+	for (; *pattern != '\0'; pattern++) {
+		if (*pattern != '%' || pattern[1] == '%') {
+			// runs of text become a single copy
+			if (literal == NULL) {
+				literal = &program->ops[program->count++];
+				literal->opcode = ASLogPrefixLiteral;
+				literal->text = text;
+			}
+			*text++ = *pattern;
+			literal->length++;
+			if (*pattern == '%')
+				pattern++;
+			continue;
+		}
+		literal = NULL;
+		needs = 0;
+		switch (*++pattern) {
+			case 'T': opcode = ASLogPrefixTimestamp; break;
+			case 'L': opcode = ASLogPrefixLevel; break;
+			case 'W': opcode = ASLogPrefixWarning; break;
+			case 't': opcode = ASLogPrefixThread; break;
+			case 'f': opcode = ASLogPrefixFile; needs = ASLogPrefixNeedsFile; break;
+			case 'l': opcode = ASLogPrefixLine; needs = ASLogPrefixNeedsFile; break;
+			case 'F': opcode = ASLogPrefixFunction; needs = ASLogPrefixNeedsFunction; break;
+			case 'm':
+				if (section != NULL || program->message >= 0)
+					goto invalid;
+				opcode = ASLogPrefixMessage;
+				program->message = program->count;
+				break;
+			case '[':
+				if (section != NULL)
+					goto invalid;
+				opcode = ASLogPrefixSection;
+				break;
+			case ']':
+				if (section == NULL)
+					goto invalid;
+				section->skip = (int)(&program->ops[program->count] - section) - 1;
+				section = NULL;
+				continue;
+			default:
+				goto invalid;
+		}
+		op = &program->ops[program->count++];
+		op->opcode = opcode;
+		if (section != NULL)
+			section->needs |= needs;
+		if (opcode == ASLogPrefixSection)
+			section = op;
+	}
+	if (section != NULL)
+		goto invalid;
+	if (program->message < 0) {
+		program->message = program->count;
+		program->ops[program->count++].opcode = ASLogPrefixMessage;
+	}
+	return program;
+	
+invalid:
+	free(program);
+	return NULL;
+}
+
+
+/*!
+ @brief Finds the program for a prefix pattern, compiling it the first time.
+ 
+ A program that has been replaced may still be running on another thread, so none is
+ ever freed. Instead each pattern is compiled once and kept on __sPrefixPrograms, 
+ charged against the memory budget, and going back to an earlier pattern reuses its 
+ program.
+ 
+ @param pattern - c-string holding the pattern.
+ 
+ @return the program, or NULL if the pattern is not valid or the budget will not 
+ allow it.
+ */
+static ASLogPrefixProgram *ASLogPrefixProgramFor(const char *pattern)
+{
+	ASLogPrefixProgram *program;
+	
+	pthread_mutex_lock(&__sPrefixLock);
+	for (program = __sPrefixPrograms; program != NULL; program = program->next)
+		if (strcmp(program->pattern, pattern) == 0)
+			break;
+	if (program == NULL && (program = ASLogPrefixCompile(pattern)) != NULL) {
+		if (ASLogMemoryReserve(ASLogMemoryPrefixPatterns, program->size)) {
+			program->next = __sPrefixPrograms;
+			__sPrefixPrograms = program;
+		} else {
+			free(program);
+			program = NULL;
+		}
+	}
+	pthread_mutex_unlock(&__sPrefixLock);
+	return program;
+}
+
+
+/*!
+ @brief Returns the system ID of the calling thread, as shown by ps and top.
+ 
+ Asked for once per thread and kept in __sThreadID.
+ */
+static unsigned long ASLogThreadID(void)
+{
+	if (__sThreadID == 0) {
+#if defined(__APPLE__)
+		uint64_t threadID;
+		
+		pthread_threadid_np(NULL, &threadID);
+		__sThreadID = (unsigned long)threadID;
+#elif defined(__linux__)
+		__sThreadID = (unsigned long)syscall(SYS_gettid);
+#else
+		__sThreadID = (unsigned long)pthread_self();
+#endif
+	}
+	return __sThreadID;
+}
+
+
+/*!
+ @brief pthread_atfork() child handler, the child and the thread carried into it have 
+ new IDs.
+ */
+static void ASLogPrefixForked(void)
+{
+	__sThreadID = 0;
+	__sProcessID = getpid();
+	pthread_mutex_init(&__sPrefixLock, NULL);
+}
+
+
+/*!
+ @brief Copies as much of a piece of a prefix as fits.
+ 
+ @param out - where to copy to.
+ 
+ @param end - end of the space available.
+ 
+ @param text - the piece.
+ 
+ @param length - length of text.
+ 
+ @return the end of what was copied.
+ */
+static char *ASLogPrefixCopy(char *out, char *end, const char *text, size_t length)
+{
+	if (length > (size_t)(end - out))
+		length = end - out;
+	memcpy(out, text, length);
+	return out + length;
+}
+
+
+/*!
+ @brief Writes an unsigned number in decimal, as much of it as fits.
+ 
+ @param out - where to write it.
+ 
+ @param end - end of the space available.
+ 
+ @param value - the number.
+ 
+ @return the end of what was written.
+ */
+static char *ASLogPrefixNumber(char *out, char *end, unsigned long value)
+{
+	char digits[24], *digit = digits + sizeof(digits);
+	
+	do {
+		*--digit = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+	return ASLogPrefixCopy(out, end, digit, digits + sizeof(digits) - digit);
+}
+
+
+/*!
+ @brief Writes the local date and time to the millisecond, "2026-10-18 14:03:27.512",
+ as NSLog() does.
+ 
+ The date and time to the second is only worked out once a second per thread, see 
+ __sDate, and the milliseconds added to it.
+ 
+ @param out - where to write it.
+ 
+ @param end - end of the space available.
+ 
+ @return the end of what was written.
+ */
+static char *ASLogPrefixDate(char *out, char *end)
+{
+	char millis[4];
+	struct timeval now;
+	struct tm local;
+	
+	gettimeofday(&now, NULL);
+	if (now.tv_sec != __sDateSecond) {
+		localtime_r(&now.tv_sec, &local);
+		strftime(__sDate, sizeof(__sDate), "%Y-%m-%d %H:%M:%S", &local);
+		__sDateSecond = now.tv_sec;
+	}
+	millis[0] = '.';
+	millis[1] = '0' + (now.tv_usec / 100000);
+	millis[2] = '0' + (now.tv_usec / 10000) % 10;
+	millis[3] = '0' + (now.tv_usec / 1000) % 10;
+	out = ASLogPrefixCopy(out, end, __sDate, strlen(__sDate));
+	return ASLogPrefixCopy(out, end, millis, 4);
+}
+
+
+/*!
+ @brief Writes the header NSLog() starts each line with, 
+ "2026-10-18 14:03:27.512 MyApp[1234:5678] ".
+ 
+ @param out - where to write it.
+ 
+ @param end - end of the space available.
+ 
+ @return the end of what was written.
+ */
+static char *ASLogFormatHeader(char *out, char *end)
+{
+	out = ASLogPrefixDate(out, end);
+	out = ASLogPrefixCopy(out, end, " ", 1);
+	out = ASLogPrefixCopy(out, end, __sProcessName, strlen(__sProcessName));
+	out = ASLogPrefixCopy(out, end, "[", 1);
+	out = ASLogPrefixNumber(out, end, (unsigned long)__sProcessID);
+	out = ASLogPrefixCopy(out, end, ":", 1);
+	out = ASLogPrefixNumber(out, end, ASLogThreadID());
+	return ASLogPrefixCopy(out, end, "] ", 2);
+}
+
+
+/*!
+ @brief Logging function that writes what NSLog() would, header and all, at a 
+ fraction of the cost.
+ 
+ Selected with +setNSLogHeaderOn: The header is put together from the cached process 
+ name and ID, a date string worked out once a second and the thread's cached ID, 
+ and the line goes out in a single write, with no lock and no NSCalendarDate. Like 
+ NSLog() a line end is added unless the message has one.
+ 
+ @param format - NSString * that holds the formatting string (vide NSLog()).
+ 
+ @param ...	- variadic argument list.
+ */
+static void ASLogHeaderLog(NSString *format, ...)
+{
+	va_list ap;
+	NSString *message;
+	const char *utf8;
+	char header[PATH_MAX + 96];
+	struct iovec iov[3];
+	
+	va_start(ap, format);
+	message = [[NSString alloc] initWithFormat:format arguments:ap];
+	va_end(ap);
+	utf8 = [message UTF8String];
+	
+	iov[0].iov_base = header;
+	iov[0].iov_len = ASLogFormatHeader(header, header + sizeof(header)) - header;
+	iov[1].iov_base = (void *)utf8;
+	iov[1].iov_len = strlen(utf8);
+	iov[2].iov_base = "\n";
+	iov[2].iov_len = 1;
+	ASLogEmit(iov, (iov[1].iov_len > 0 && utf8[iov[1].iov_len - 1] == '\n' ? 2 : 3));
+	[message release];
+}
+
+
+/*!
+ @brief Runs part of a compiled prefix pattern.
+ 
+ @param program - the compiled pattern.
+ 
+ @param first - index of the first operation to run.
+ 
+ @param last - index just past the last operation to run.
+ 
+ @param out - buffer to write to, always NUL terminated.
+ 
+ @param size - size of out, the output is cut short to fit.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file, or NULL.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function, or NULL.
+ 
+ @return the length written, not counting the NUL.
+ */
+static size_t ASLogPrefixRun(const ASLogPrefixProgram *program, int first, int last, char *out, size_t size, 
+							 ASLogLevel level, const char *sourceFile, int lineNumber, const char *functionName)
+{
+	static const char *levelNames[] = { "DEBUG", "NORMAL", "WARNING" };
+	int available = (sourceFile != NULL ? ASLogPrefixNeedsFile : 0) | (functionName != NULL ? ASLogPrefixNeedsFunction : 0);
+	const ASLogPrefixOp *op;
+	char *next = out, *end = out + size - 1;
+	int i;
+	
+	for (i = first; i < last; i++) {
+		op = &program->ops[i];
+		switch (op->opcode) {
+			case ASLogPrefixLiteral:
+				next = ASLogPrefixCopy(next, end, op->text, op->length);
+				break;
+			case ASLogPrefixSection:
+				if ((op->needs & ~available) != 0)
+					i += op->skip;
+				break;
+			case ASLogPrefixTimestamp:
+				next = ASLogPrefixDate(next, end);
+				break;
+			case ASLogPrefixLevel:
+				next = ASLogPrefixCopy(next, end, levelNames[level], strlen(levelNames[level]));
+				break;
+			case ASLogPrefixWarning:
+				if (level == ASLogLevelWarning)
+					next = ASLogPrefixCopy(next, end, "WARNING: ", 9);
+				break;
+			case ASLogPrefixThread:
+				next = ASLogPrefixNumber(next, end, ASLogThreadID());
+				break;
+			case ASLogPrefixFile:
+				if (sourceFile != NULL)
+					next = ASLogPrefixCopy(next, end, ASLogBaseName(sourceFile), strlen(ASLogBaseName(sourceFile)));
+				break;
+			case ASLogPrefixLine:
+				if (sourceFile != NULL)
+					next = ASLogPrefixNumber(next, end, (unsigned long)lineNumber);
+				break;
+			case ASLogPrefixFunction:
+				if (functionName != NULL)
+					next = ASLogPrefixCopy(next, end, functionName, strlen(functionName));
+				break;
+		}
+	}
+	*next = '\0';
+	return next - out;
+}
+
+
+/*!
+ @brief Writes what goes before and after the message of a line, laid out by the 
+ current prefix pattern.
+ 
+ The prefix is written at the start of out and the suffix just after it, each NUL 
+ terminated. The suffix does not include the line end. Lines written without going 
+ through the logging function can be given the NSLog() header it would have added.
+ 
+ @param out - buffer to write to.
+ 
+ @param size - size of out, the prefix and then the suffix are cut short to fit.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file, or NULL.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function, or NULL.
+ 
+ @param withHeader - BOOL, YES to start with the NSLog() header if ASLogHeaderLog() is
+ the logging function.
+ 
+ @param suffix - set to the suffix.
+ 
+ @return the length of the prefix.
+ */
+static size_t ASLogFormatPrefix(char *out, size_t size, ASLogLevel level, const char *sourceFile, int lineNumber, 
+								const char *functionName, BOOL withHeader, struct iovec *suffix)
+{
+	const ASLogPrefixProgram *program = __sPrefixProgram;
+	size_t length = 0;
+	
+	if (withHeader && __sCurLogFunc == ASLogHeaderLog)
+		length = ASLogFormatHeader(out, out + size / 2) - out;
+	// one byte is always left for the suffix's NUL
+	length += ASLogPrefixRun(program, 0, program->message, out + length, size - length - 1, 
+							 level, sourceFile, lineNumber, functionName);
+	suffix->iov_base = out + length + 1;
+	suffix->iov_len = ASLogPrefixRun(program, program->message + 1, program->count, out + length + 1, size - length - 1, 
+									 level, sourceFile, lineNumber, functionName);
+	return length;
+}
+
+
+#pragma mark Asynchronous output
+
+/*!
+ @brief Allocates the memory for a lane's ring.
+ 
+ On Linux the ring can be placed on a NUMA node and backed by huge pages. Pages are 
+ placed when first touched, so the node is set before anything is written to it. 
+ Elsewhere, or with neither asked for, it is plain malloc() memory.
+ 
+ @param size - size of the ring, a whole number of huge pages when they are used.
+ 
+ @param huge - YES to back the ring with huge pages.
+ 
+ @param node - NUMA node to place the ring on, or -1 for anywhere.
+ 
+ @return the ring, or NULL.
+ */
+static char *ASLogLaneAllocate(size_t size, BOOL huge, int node)
+{
+#if defined(__linux__)
+	unsigned long mask;
+	void *bytes = MAP_FAILED;
+	
+	if (!huge && node < 0)
+		return malloc(size);
+	
+	if (huge)
+		bytes = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (bytes == MAP_FAILED) {
+		// no huge pages reserved, ask for transparent ones instead
+		bytes = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (bytes == MAP_FAILED)
+			return NULL;
+		if (huge)
+			madvise(bytes, size, MADV_HUGEPAGE);
+	}
+	if (node >= 0) {
+		mask = 1UL << node;
+		syscall(SYS_mbind, bytes, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+	}
+	return bytes;
+#else
+	return malloc(size);
+#endif
+}
+
+
+/*!
+ @brief Sets up a lane, the first time asynchronous output is turned on.
+ 
+ If the memory budget does not stretch to the size asked for the ring is halved until
+ it fits, down to ASLogMinimumQueueSize, and the lane drops more.
+ 
+ With huge pages on, only a ring of at least ASLogHugePageSize is backed by them, 
+ rounded up to whole ones. A smaller ring, such as the warning lane's, gets normal 
+ pages rather than be rounded up to a huge page it would mostly leave empty.
+ 
+ @param node - NUMA node to place the ring on, or -1 for anywhere.
+ 
+ @return NO if the ring could not be allocated.
+ */
+static BOOL ASLogLaneInit(ASLogLane *lane, size_t size, BOOL blocking, int node)
+{
+	BOOL huge;
+	
+	for (;;) {
+		huge = (__sAsyncHugePages && size >= ASLogHugePageSize);
+		if (huge)
+			size = (size + ASLogHugePageSize - 1) / ASLogHugePageSize * ASLogHugePageSize;
+		if (ASLogMemoryReserve(ASLogMemoryQueues, size))
+			break;
+		if (size <= ASLogMinimumQueueSize)
+			return NO;
+		size = (size / 2 < ASLogMinimumQueueSize ? ASLogMinimumQueueSize : size / 2);
+	}
+	lane->bytes = ASLogLaneAllocate(size, huge, node);
+	if (lane->bytes == NULL) {
+		ASLogMemoryRelease(ASLogMemoryQueues, size);
+		return NO;
+	}
+	pthread_mutex_init(&lane->lock, NULL);
+	pthread_cond_init(&lane->space, NULL);
+	lane->size = size;
+	lane->head = lane->tail = 0;
+	lane->blocking = blocking;
+	return YES;
+}
+
+
+/*!
+ @brief Counts the NUMA nodes, up to ASLogMaxNodes.
+ 
+ @return the number of nodes, 1 where that cannot be told.
+ */
+static int ASLogNodeCount(void)
+{
+	int count = 1;
+#if defined(__linux__)
+	char path[64];
+	
+	while (count < ASLogMaxNodes) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", count);
+		if (access(path, F_OK) != 0)
+			break;
+		count++;
+	}
+#endif
+	return count;
+}
+
+
+/*!
+ @brief Picks the bulk lane for the calling thread, the one on its NUMA node.
+ 
+ A thread that migrates to another node moves to that node's lane, so its lines can 
+ come out of order around the move.
+ */
+static ASLogLane *ASLogBulkLane(void)
+{
+#if defined(__linux__)
+	unsigned int cpu, node;
+	
+	if (__sBulkLaneCount > 1 && syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		return &__sBulkLanes[node % __sBulkLaneCount];
+#endif
+	return &__sBulkLanes[0];
+}
+
+
+/*!
+ @brief Tells whether the lanes are empty, read without the locks.
+ 
+ @param warningsOnly - YES to look only at the warning lane.
+ */
+static BOOL ASLogLanesEmpty(BOOL warningsOnly)
+{
+	int i;
+	
+	if (__sWarningLane.head != __sWarningLane.tail || __sWarningLane.records != NULL)
+		return NO;
+	for (i = 0; !warningsOnly && i < __sBulkLaneCount; i++) {
+		if (__sBulkLanes[i].head != __sBulkLanes[i].tail || __sBulkLanes[i].records != NULL)
+			return NO;
+	}
+	return YES;
+}
+
+
+/*!
+ @brief Wakes the writer thread, if it is parked.
+ 
+ The full barrier pairs with the one in ASLogWriterPark(): either the writer sees the
+ line just queued or this sees the writer parked. When the writer is busy, or sleeping
+ out a batch interval and the line is not urgent, this costs no system call.
+ 
+ @param urgent - BOOL, YES for a warning, which also ends a batch interval.
+ */
+static void ASLogWakeWriter(BOOL urgent)
+{
+	int parked;
+	
+	__sync_synchronize();
+	parked = __sWriterParked;
+	if (parked == ASLogWriterRunning || (parked == ASLogWriterParkedUrgent && !urgent))
+		return;
+#if defined(__linux__)
+	// only the producer that unparks the writer makes the system call
+	if (__sync_bool_compare_and_swap(&__sWriterParked, parked, ASLogWriterRunning))
+		syscall(SYS_futex, &__sWriterParked, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&__sWakeLock);
+	pthread_cond_signal(&__sWakeCond);
+	pthread_mutex_unlock(&__sWakeLock);
+#endif
+}
+
+/*!
+ @brief Copies log lines, in pieces, onto the end of a lane.
+ 
+ If the lane is full a blocking lane waits for the writer to make room, otherwise the
+ lines are dropped and counted.
+ 
+ @param lane - the lane.
+ 
+ @param iov - the pieces of the lines, which must total no more than the lane's size.
+ 
+ @param count - number of pieces.
+ 
+ @param lines - number of lines, for the dropped count.
+ 
+ @return YES if the lines were queued.
+ */
+static BOOL ASLogLaneWrite(ASLogLane *lane, const struct iovec *iov, int count, unsigned long lines)
+{
+	size_t length = 0, offset, first;
+	int i;
+	
+	for (i = 0; i < count; i++)
+		length += iov[i].iov_len;
+	
+	pthread_mutex_lock(&lane->lock);
+	while (lane->size - (lane->head - lane->tail) < length) {
+		if (!lane->blocking) {
+			lane->dropped += lines;
+			pthread_mutex_unlock(&lane->lock);
+			return NO;
+		}
+		lane->waiters++;
+		pthread_cond_wait(&lane->space, &lane->lock);
+		lane->waiters--;
+	}
+	for (i = 0; i < count; i++) {
+		offset = lane->head % lane->size;
+		first = (iov[i].iov_len < lane->size - offset ? iov[i].iov_len : lane->size - offset);
+		memcpy(lane->bytes + offset, iov[i].iov_base, first);
+		memcpy(lane->bytes, (const char *)iov[i].iov_base + first, iov[i].iov_len - first);
+		lane->head += iov[i].iov_len;
+	}
+	pthread_mutex_unlock(&lane->lock);
+	
+	ASLogWakeWriter(lane->blocking);
+	return YES;
+}
+
+
+/*!
+ @brief Copies a stage's lines into their lane in one go and empties the stage.
+ 
+ Called with the stage's lock held. If the lane is full the lines are dropped and 
+ counted.
+ 
+ @param stage - the stage.
+ */
+static void ASLogStageFlush(ASLogStage *stage)
+{
+	struct iovec iov;
+	
+	if (stage->length == 0)
+		return;
+	iov.iov_base = stage->bytes;
+	iov.iov_len = stage->length;
+	ASLogLaneWrite(stage->lane, &iov, 1, stage->lines);
+	stage->length = 0;
+	stage->lines = 0;
+	__sync_fetch_and_sub(&__sStagesPending, 1);
+}
+
+
+/*!
+ @brief Destructor for the per-thread stage, called as a thread exits.
+ 
+ The stage is taken off __sStages, its lines queued and it is freed.
+ */
+static void ASLogStageFree(void *context)
+{
+	ASLogStage *stage = context, **link;
+	
+	pthread_mutex_lock(&__sStageLock);
+	for (link = &__sStages; *link != NULL; link = &(*link)->next) {
+		if (*link == stage) {
+			*link = stage->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&__sStageLock);
+	
+	pthread_mutex_lock(&stage->lock);
+	ASLogStageFlush(stage);
+	pthread_mutex_unlock(&stage->lock);
+	pthread_mutex_destroy(&stage->lock);
+	free(stage);
+	ASLogMemoryRelease(ASLogMemoryStaging, sizeof(ASLogStage));
+}
+
+
+/*!
+ @brief Gets the calling thread's stage, allocating it the first time.
+ 
+ @return the stage, or NULL if out of memory or budget.
+ */
+static ASLogStage *ASLogStageGet(void)
+{
+	ASLogStage *stage = pthread_getspecific(__sStageKey);
+	
+	if (stage != NULL)
+		return stage;
+	if (!ASLogMemoryReserve(ASLogMemoryStaging, sizeof(ASLogStage)))
+		return NULL;
+	stage = calloc(1, sizeof(ASLogStage));
+	if (stage == NULL) {
+		ASLogMemoryRelease(ASLogMemoryStaging, sizeof(ASLogStage));
+		return NULL;
+	}
+	pthread_mutex_init(&stage->lock, NULL);
+	pthread_setspecific(__sStageKey, stage);
+	pthread_mutex_lock(&__sStageLock);
+	stage->next = __sStages;
+	__sStages = stage;
+	pthread_mutex_unlock(&__sStageLock);
+	return stage;
+}
+
+
+/*!
+ @brief Copies the calling thread's staged lines into their lane, so that whatever it
+ queues next comes after them.
+ */
+static void ASLogStageFlushThread(void)
+{
+	ASLogStage *stage;
+	
+	if (__sStagesPending == 0 || (stage = pthread_getspecific(__sStageKey)) == NULL)
+		return;
+	pthread_mutex_lock(&stage->lock);
+	ASLogStageFlush(stage);
+	pthread_mutex_unlock(&stage->lock);
+}
+
+
+/*!
+ @brief Gathers a debug or normal line in the calling thread's stage.
+ 
+ The stage is copied into its lane first if the line does not fit, and straight 
+ after if its first line has waited __sStageInterval. The writer thread is woken only
+ when the first stage fills, so that it sweeps stages left waiting, see 
+ ASLogStageSweep().
+ 
+ @param iov - the pieces of the line.
+ 
+ @param count - number of pieces.
+ 
+ @param length - total length of the line.
+ 
+ @return YES if the line was staged, NO to queue it directly, after anything staged.
+ */
+static BOOL ASLogStageWrite(const struct iovec *iov, int count, size_t length)
+{
+	ASLogStage *stage;
+	uint64_t now;
+	BOOL wake = NO;
+	int i;
+	
+	if (length > ASLogStageSize || (stage = ASLogStageGet()) == NULL) {
+		ASLogStageFlushThread();
+		return NO;
+	}
+	now = ASLogNow();
+	pthread_mutex_lock(&stage->lock);
+	if (stage->length + length > ASLogStageSize)
+		ASLogStageFlush(stage);
+	if (stage->length == 0) {
+		stage->lane = ASLogBulkLane();
+		stage->since = now;
+		wake = (__sync_fetch_and_add(&__sStagesPending, 1) == 0);
+	}
+	for (i = 0; i < count; i++) {
+		memcpy(stage->bytes + stage->length, iov[i].iov_base, iov[i].iov_len);
+		stage->length += iov[i].iov_len;
+	}
+	stage->lines++;
+	if (now - stage->since >= __sStageInterval)
+		ASLogStageFlush(stage);
+	pthread_mutex_unlock(&stage->lock);
+	
+	if (wake)
+		ASLogWakeWriter(NO);
+	return YES;
+}
+
+
+/*!
+ @brief Copies stages whose lines have waited __sStageInterval into their lanes, for
+ threads that have stopped logging.
+ 
+ Called by the writer thread, and by +flush. The writer thread skips a stage whose 
+ owner is staging a line, the owner flushes it itself if it is due.
+ 
+ @param all - YES to copy every stage holding lines, however long they have waited.
+ */
+static void ASLogStageSweep(BOOL all)
+{
+	ASLogStage *stage;
+	uint64_t now = ASLogNow();
+	
+	pthread_mutex_lock(&__sStageLock);
+	for (stage = __sStages; stage != NULL; stage = stage->next) {
+		// checked again under the lock
+		if (stage->length == 0 || (!all && now - stage->since < __sStageInterval))
+			continue;
+		if (all)
+			pthread_mutex_lock(&stage->lock);
+		else if (pthread_mutex_trylock(&stage->lock) != 0)
+			continue;
+		if (all || now - stage->since >= __sStageInterval)
+			ASLogStageFlush(stage);
+		pthread_mutex_unlock(&stage->lock);
+	}
+	pthread_mutex_unlock(&__sStageLock);
+}
+
+
+/*!
+ @brief Queues a record at the lane's current head, so the writer thread writes it in
+ its place among the lines around it.
+ */
+static void ASLogLaneQueueRecord(ASLogLane *lane, ASLogRecord *record)
+{
+	if (lane != &__sWarningLane)
+		ASLogStageFlushThread();
+	pthread_mutex_lock(&lane->lock);
+	record->position = lane->head;
+	if (lane->lastRecord != NULL)
+		lane->lastRecord->next = record;
+	else
+		lane->records = record;
+	lane->lastRecord = record;
+	pthread_mutex_unlock(&lane->lock);
+	
+	ASLogWakeWriter(lane->blocking);
+}
+
+
+/*!
+ @brief Queues a line too big for its lane's ring, in a record from the thread's pool.
+ 
+ The record is queued at the lane's current head, so the writer thread writes it in
+ its place among the lines around it. If the pools are out of budget the line is 
+ written straight to stderr, or dropped and counted, as __sPoolFull says. Warnings
+ are never dropped.
+ */
+static void ASLogLaneWriteRecord(ASLogLane *lane, const struct iovec *iov, int count, size_t length)
+{
+	ASLogRecord *record = ASLogPoolTake(length);
+	int i;
+	
+	if (record == NULL) {
+		if (__sPoolFull == ASLogPoolFullDrop && !lane->blocking) {
+			pthread_mutex_lock(&lane->lock);
+			lane->dropped++;
+			pthread_mutex_unlock(&lane->lock);
+		} else {
+			ASLogEmit(iov, count);
+		}
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		memcpy(record->bytes + record->length, iov[i].iov_base, iov[i].iov_len);
+		record->length += iov[i].iov_len;
+	}
+	ASLogLaneQueueRecord(lane, record);
+}
+
+
+/*!
+ @brief Queues a log line, or its pieces, for the writer thread.
+ 
+ Warnings go in the warning lane, which is always drained first and has its own 
+ space, so they are never held up or dropped because of a flood of debug lines. A 
+ line too big for its lane goes in a pooled record instead, see ASLogLaneWriteRecord().
+ With staging on other lines are gathered in the thread's stage, see 
+ ASLogStageWrite(), while warnings always go straight into their lane. Lines logged 
+ on the writer thread itself, from a deferred block or a -description, are written 
+ straight away instead.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param iov - the pieces of the line, including its line end.
+ 
+ @param count - number of pieces.
+ */
+static void ASLogAsyncEnqueue(ASLogLevel level, struct iovec *iov, int count)
+{
+	ASLogLane *lane = (level == ASLogLevelWarning ? &__sWarningLane : ASLogBulkLane());
+	size_t length = 0;
+	int i;
+	
+	// waiting for room in a lane would wait for the writer itself
+	if (__sOnWriter) {
+		ASLogEmit(iov, count);
+		return;
+	}
+	for (i = 0; i < count; i++)
+		length += iov[i].iov_len;
+	if (length > lane->size / 2) {
+		ASLogLaneWriteRecord(lane, iov, count, length);
+		return;
+	}
+	if (lane != &__sWarningLane) {
+		if (__sStagingOn && ASLogStageWrite(iov, count, length))
+			return;
+		// lines staged before staging was turned off go first
+		ASLogStageFlushThread();
+	}
+	ASLogLaneWrite(lane, iov, count, 1);
+}
+
+
+#if defined(__BLOCKS__)
+/*!
+ @brief Queues a line whose message is made by a block run on the writer thread.
+ 
+ The prefix and suffix are laid out now, so the line shows when and where it was 
+ logged, and go in a record from the thread's pool along with a copy of the block.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param block - returns the message.
+ 
+ @return YES if the line was queued, NO if the pools are out of budget.
+ */
+static BOOL ASLogAsyncEnqueueDeferred(ASLogLevel level, const char *sourceFile, int lineNumber, NSString *(^block)(void))
+{
+	ASLogLane *lane = (level == ASLogLevelWarning ? &__sWarningLane : ASLogBulkLane());
+	char prefix[PATH_MAX + 256];
+	struct iovec suffix;
+	size_t length;
+	ASLogRecord *record;
+	
+	length = ASLogFormatPrefix(prefix, sizeof(prefix), level, sourceFile, lineNumber, NULL, YES, &suffix);
+	record = ASLogPoolTake(length + suffix.iov_len + 1);
+	if (record == NULL)
+		return NO;
+	memcpy(record->bytes, prefix, length);
+	memcpy(record->bytes + length, suffix.iov_base, suffix.iov_len);
+	record->bytes[length + suffix.iov_len] = '\n';
+	record->length = length + suffix.iov_len + 1;
+	record->split = length;
+	record->end = length;
+	record->deferred = (void *)Block_copy(block);
+	ASLogLaneQueueRecord(lane, record);
+	return YES;
+}
+#endif
+
+
+/*!
+ @brief Rounds an offset into a record's bytes up so that what is put there is aligned.
+ 
+ Records themselves are allocated aligned, bytes is not necessarily, so the rounding
+ is relative to the start of the record.
+ 
+ @param offset - size_t, offset into bytes.
+ 
+ @param alignment - size_t, a power of two.
+ 
+ @return The offset rounded up.
+ */
+static size_t ASLogRecordAlign(size_t offset, size_t alignment)
+{
+	size_t base = offsetof(ASLogRecord, bytes);
+	
+	return ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+}
+
+
+/*!
+ @brief Queues a line whose %@ arguments are left to the writer thread, see 
+ ASLogBufferDefer().
+ 
+ The line goes in a record from the thread's pool, with the arguments after it. The 
+ buffer gives up its references to them.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file, or NULL.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function, or NULL.
+ 
+ @param buffer - the message, with the arguments it left.
+ 
+ @return YES if the line was queued, NO if the pools are out of budget.
+ */
+static BOOL ASLogAsyncEnqueueObjects(ASLogLevel level, const char *sourceFile, int lineNumber, const char *functionName, 
+									 ASLogBuffer *buffer)
+{
+	ASLogLane *lane = (level == ASLogLevelWarning ? &__sWarningLane : ASLogBulkLane());
+	char prefix[PATH_MAX + 256];
+	struct iovec suffix;
+	size_t length, line;
+	ASLogRecord *record;
+	
+	length = ASLogFormatPrefix(prefix, sizeof(prefix), level, sourceFile, lineNumber, functionName, YES, &suffix);
+	// the arguments go after the line, aligned
+	line = ASLogRecordAlign(length + buffer->length + suffix.iov_len + 1, __alignof__(ASLogDeferredObject));
+	record = ASLogPoolTake(line + buffer->objectCount * sizeof(ASLogDeferredObject));
+	if (record == NULL)
+		return NO;
+	memcpy(record->bytes, prefix, length);
+	memcpy(record->bytes + length, buffer->bytes, buffer->length);
+	memcpy(record->bytes + length + buffer->length, suffix.iov_base, suffix.iov_len);
+	record->length = length + buffer->length + suffix.iov_len;
+	record->bytes[record->length++] = '\n';
+	record->split = length;
+	// a trailer goes out with the suffix, whatever the arguments come to
+	record->end = length + buffer->length - buffer->trailer;
+	record->objects = (ASLogDeferredObject *)(record->bytes + line);
+	memcpy(record->objects, buffer->objects, buffer->objectCount * sizeof(ASLogDeferredObject));
+	record->objectCount = buffer->objectCount;
+	record->truncated = buffer->truncated;
+	buffer->objectCount = 0;
+	ASLogLaneQueueRecord(lane, record);
+	return YES;
+}
+
+
+/*!
+ @brief Queues a line from the C logging macros, to be formatted by the writer thread.
+ 
+ The prefix and suffix are laid out now. The line goes in a record from the thread's
+ pool, with the arguments after it and then a copy of each c-string argument, cut at
+ __sMaxRecordLength.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling function, or NULL.
+ 
+ @param site - the call site.
+ 
+ @param values - its arguments.
+ 
+ @return YES if the line was queued, NO if the pools are out of budget.
+ */
+static BOOL ASLogAsyncEnqueueValues(ASLogLevel level, const char *sourceFile, int lineNumber, const char *functionName, 
+									const ASLogCSite *site, const ASLogCValue *values)
+{
+	ASLogLane *lane = (level == ASLogLevelWarning ? &__sWarningLane : ASLogBulkLane());
+	char prefix[PATH_MAX + 256];
+	struct iovec suffix;
+	size_t length, line, strings = 0, lengths[ASLogCMaxArguments];
+	ASLogRecord *record;
+	char *text;
+	int i;
+	
+	for (i = 0; i < site->count; i++) {
+		if (site->signature[i] == 's' && values[i].s != NULL) {
+			lengths[i] = strnlen(values[i].s, __sMaxRecordLength);
+			strings += lengths[i] + 1;
+		}
+	}
+	length = ASLogFormatPrefix(prefix, sizeof(prefix), level, sourceFile, lineNumber, functionName, YES, &suffix);
+	// the arguments go after the line, aligned
+	line = ASLogRecordAlign(length + suffix.iov_len + 1, __alignof__(ASLogCValue));
+	record = ASLogPoolTake(line + site->count * sizeof(ASLogCValue) + strings);
+	if (record == NULL)
+		return NO;
+	memcpy(record->bytes, prefix, length);
+	memcpy(record->bytes + length, suffix.iov_base, suffix.iov_len);
+	record->bytes[length + suffix.iov_len] = '\n';
+	record->length = length + suffix.iov_len + 1;
+	record->split = length;
+	record->end = length;
+	record->values = (ASLogCValue *)(record->bytes + line);
+	memcpy(record->values, values, site->count * sizeof(ASLogCValue));
+	text = (char *)(record->values + site->count);
+	for (i = 0; i < site->count; i++) {
+		if (site->signature[i] == 's' && values[i].s != NULL) {
+			memcpy(text, values[i].s, lengths[i]);
+			text[lengths[i]] = '\0';
+			record->values[i].s = text;
+			text += lengths[i] + 1;
+		}
+	}
+	record->site = site;
+	ASLogLaneQueueRecord(lane, record);
+	return YES;
+}
+
+
+/*!
+ @brief Writes out a pooled record on the writer thread.
+ 
+ A deferred message's block is run first, or the -description of its %@ arguments 
+ called, or a C call site's format and arguments formatted, in an autorelease pool of
+ its own, and its message formatted into the writer thread's buffer. Only the write 
+ is timed for load shedding.
+ 
+ @param record - the record, handed back to its pool by the caller.
+ */
+static void ASLogRecordEmit(ASLogRecord *record)
+{
+	struct iovec iov[3];
+	uint64_t begin;
+	NSAutoreleasePool *pool;
+	ASLogBuffer *buffer;
+	
+	if (record->deferred != NULL || record->objectCount > 0 || record->site != NULL) {
+		pool = [[NSAutoreleasePool alloc] init];
+		buffer = ASLogBufferAcquire();
+		if (buffer != NULL) {
+			if (record->site != NULL) {
+				ASLogCFormat(buffer, record->site, record->values);
+			} else if (record->objectCount > 0) {
+				ASLogBufferExpand(buffer, record->bytes + record->split, record->end - record->split, 
+								  record->objects, record->objectCount, record->truncated, 0);
+				record->objectCount = 0;
+			}
+#if defined(__BLOCKS__)
+			else {
+				ASLogBufferAppendObject(buffer, ((NSString *(^)(void))record->deferred)(), 0);
+				ASLogBufferFinish(buffer);
+			}
+#endif
+			iov[0].iov_base = record->bytes;
+			iov[0].iov_len = record->split;
+			iov[1].iov_base = buffer->bytes;
+			iov[1].iov_len = buffer->length;
+			iov[2].iov_base = record->bytes + record->end;
+			iov[2].iov_len = record->length - record->end;
+			begin = ASLogNow();
+			ASLogEmit(iov, 3);
+			ASLogShedRecord(begin);
+			ASLogBufferRelease(buffer);
+		}
+		[pool release];
+		return;
+	}
+	iov[0].iov_base = record->bytes;
+	iov[0].iov_len = record->length;
+	begin = ASLogNow();
+	ASLogEmit(iov, 1);
+	ASLogShedRecord(begin);
+}
+
+
+/*!
+ @brief Writes out what is queued in a lane, up to a limit.
+ 
+ Called only on the writer thread. The bytes are written straight from the ring, with
+ no lock held, and only then released to producers. Writing stops at the next pooled
+ record, which is written on its own once the ring has been written up to it, see 
+ ASLogRecordEmit().
+ 
+ @param lane - the lane.
+ 
+ @param limit - maximum number of bytes to write, cut back to the end of a line.
+ 
+ @return the number of bytes written.
+ */
+static size_t ASLogLaneDrain(ASLogLane *lane, size_t limit)
+{
+	struct iovec iov[2];
+	size_t used, start, first, cut;
+	uint64_t begin;
+	ASLogRecord *record;
+	
+	pthread_mutex_lock(&lane->lock);
+	used = lane->head - lane->tail;
+	start = lane->tail % lane->size;
+	record = lane->records;
+	if (record != NULL && record->position == lane->tail) {
+		lane->records = record->next;
+		if (lane->records == NULL)
+			lane->lastRecord = NULL;
+		pthread_mutex_unlock(&lane->lock);
+		
+		used = record->length;
+		ASLogRecordEmit(record);
+		ASLogPoolReturn(record);
+		return used;
+	}
+	if (record != NULL && record->position - lane->tail < used)
+		used = record->position - lane->tail;
+	pthread_mutex_unlock(&lane->lock);
+	if (used == 0)
+		return 0;
+	if (used > limit) {
+		// stop at the end of a line, so a warning never lands in the middle of one
+		for (cut = limit; cut > 0 && lane->bytes[(start + cut - 1) % lane->size] != '\n'; cut--)
+			;
+		if (cut > 0)
+			used = cut;
+	}
+	
+	first = (used < lane->size - start ? used : lane->size - start);
+	iov[0].iov_base = lane->bytes + start;
+	iov[0].iov_len = first;
+	iov[1].iov_base = lane->bytes;
+	iov[1].iov_len = used - first;
+	begin = ASLogNow();
+	ASLogEmit(iov, (used > first ? 2 : 1));
+	ASLogShedRecord(begin);
+	
+	pthread_mutex_lock(&lane->lock);
+	lane->tail += used;
+	if (lane->waiters > 0)
+		pthread_cond_broadcast(&lane->space);
+	pthread_mutex_unlock(&lane->lock);
+	return used;
+}
+
+
+/*!
+ @brief Works out an absolute deadline for pthread_cond_timedwait().
+ 
+ @param until - set to the deadline.
+ 
+ @param timeout - microseconds from now.
+ */
+static void ASLogDeadline(struct timespec *until, uint64_t timeout)
+{
+	struct timeval now;
+	uint64_t usec;
+	
+	gettimeofday(&now, NULL);
+	usec = (uint64_t)now.tv_usec + timeout;
+	until->tv_sec = now.tv_sec + (time_t)(usec / 1000000);
+	until->tv_nsec = (long)(usec % 1000000) * 1000;
+}
+
+
+/*!
+ @brief Parks the writer thread until there is work, or the timeout passes.
+ 
+ Producers only signal when __sWriterParked is set. The lanes are checked again after
+ setting it, see ASLogWakeWriter(). On Linux the writer sleeps on __sWriterParked as
+ a futex, elsewhere on a condition variable.
+ 
+ @param timeout - longest to sleep, in microseconds.
+ 
+ @param state - ASLogWriterParkedAny, or ASLogWriterParkedUrgent to sleep through 
+ everything but warnings.
+ */
+static void ASLogWriterPark(uint64_t timeout, int state)
+{
+#if defined(__linux__)
+	struct timespec wait;
+#else
+	struct timespec until;
+#endif
+	BOOL idle;
+	
+	// anyone in +flush can stop waiting
+	pthread_mutex_lock(&__sWakeLock);
+	pthread_cond_broadcast(&__sDrainedCond);
+#if defined(__linux__)
+	pthread_mutex_unlock(&__sWakeLock);
+#endif
+	
+	__sWriterParked = state;
+	__sync_synchronize();
+	idle = ASLogLanesEmpty(state == ASLogWriterParkedUrgent);
+#if defined(__linux__)
+	if (idle) {
+		wait.tv_sec = (time_t)(timeout / 1000000);
+		wait.tv_nsec = (long)(timeout % 1000000) * 1000;
+		syscall(SYS_futex, &__sWriterParked, FUTEX_WAIT_PRIVATE, state, &wait, NULL, 0);
+	}
+	__sWriterParked = ASLogWriterRunning;
+#else
+	if (idle) {
+		ASLogDeadline(&until, timeout);
+		pthread_cond_timedwait(&__sWakeCond, &__sWakeLock, &until);
+	}
+	__sWriterParked = ASLogWriterRunning;
+	pthread_mutex_unlock(&__sWakeLock);
+#endif
+}
+
+
+/*!
+ @brief Lets a spinning writer thread give the CPU's other hyperthread a turn.
+ */
+static void ASLogCPURelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+
+/*!
+ @brief Applies the CPU pinning and priority settings to the writer thread.
+ 
+ Called on the writer thread itself. A thread that was pinned and no longer should 
+ be is let run on every CPU again. Linux only, elsewhere the settings are ignored.
+ */
+static void ASLogWriterApplySettings(void)
+{
+#if defined(__linux__)
+	static BOOL pinned = NO;
+	cpu_set_t cpus;
+	struct sched_param param;
+	int cpu = __sWriterCPU, i;
+	
+	if (cpu >= 0 && cpu < CPU_SETSIZE) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pinned = (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0);
+	} else if (pinned) {
+		// the kernel leaves out CPUs the process may not use
+		CPU_ZERO(&cpus);
+		for (i = 0; i < CPU_SETSIZE; i++)
+			CPU_SET(i, &cpus);
+		pinned = (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0);
+	}
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), (__sWriterIdle ? SCHED_IDLE : SCHED_OTHER), &param);
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), __sWriterNice);
+#endif
+}
+
+/*!
+ @brief Body of the writer thread.
+ 
+ Empties the warning lane, then writes at most ASLogBulkChunk bytes of the bulk lane 
+ before looking at the warning lane again, so warnings reach stderr in bounded time 
+ however much debug output is queued. Lines dropped from the bulk lane are reported.
+ 
+ When there is nothing to write it waits as __sWriterWakeup says: sleeping until 
+ signalled, spinning, spinning for a while and then sleeping, or sleeping out a batch
+ interval that only a warning cuts short.
+ */
+static void *ASLogWriterMain(void *context)
+{
+	char notice[128];
+	unsigned long dropped;
+	size_t written;
+	uint64_t now, idleSince = 0, swept = 0, park;
+	struct iovec iov;
+	int i;
+	
+	__sOnWriter = YES;
+	for (;;) {
+		if (__sWriterSettingsChanged) {
+			__sWriterSettingsChanged = NO;
+			ASLogWriterApplySettings();
+		}
+		
+		// stages whose threads have gone quiet, checked twice an interval
+		park = ASLogParkTimeout;
+		if (__sStagesPending > 0) {
+			now = ASLogNow();
+			if (now - swept >= __sStageInterval / 2) {
+				ASLogStageSweep(NO);
+				swept = now;
+			}
+			if (__sStageInterval / 2 + 1 < park)
+				park = __sStageInterval / 2 + 1;
+		}
+		
+		written = ASLogLaneDrain(&__sWarningLane, SIZE_MAX);
+		dropped = 0;
+		for (i = 0; i < __sBulkLaneCount; i++) {
+			written += ASLogLaneDrain(&__sBulkLanes[i], ASLogBulkChunk);
+			if (__sBulkLanes[i].dropped != 0) {
+				pthread_mutex_lock(&__sBulkLanes[i].lock);
+				dropped += __sBulkLanes[i].dropped;
+				__sBulkLanes[i].dropped = 0;
+				pthread_mutex_unlock(&__sBulkLanes[i].lock);
+			}
+		}
+		
+		if (dropped != 0) {
+			iov.iov_base = notice;
+			iov.iov_len = snprintf(notice, sizeof(notice), "ASLog: %lu lines dropped, the asynchronous queue was full\n", dropped);
+			ASLogEmit(&iov, 1);
+		}
+		
+		if (written != 0) {
+			idleSince = 0;
+			continue;
+		}
+		switch (__sWriterWakeup) {
+			case ASLogWriterWakeupSpin:
+				ASLogCPURelax();
+				break;
+			case ASLogWriterWakeupSpinThenBlock:
+				now = ASLogNow();
+				if (idleSince == 0)
+					idleSince = now;
+				if (now - idleSince < __sWriterInterval)
+					ASLogCPURelax();
+				else
+					ASLogWriterPark(park, ASLogWriterParkedAny);
+				break;
+			case ASLogWriterWakeupInterval:
+				// no interval would be a spin, wake on any line instead
+				if (__sWriterInterval == 0)
+					ASLogWriterPark(park, ASLogWriterParkedAny);
+				else
+					ASLogWriterPark((__sWriterInterval < park ? __sWriterInterval : park), ASLogWriterParkedUrgent);
+				break;
+			default:
+				ASLogWriterPark(park, ASLogWriterParkedAny);
+				break;
+		}
+	}
+	return NULL;
+}
+
+/*!
+ @brief Waits until the writer thread has written everything queued so far.
+ */
+static void ASLogAsyncFlush(void)
+{
+	struct timespec until;
+	
+	// the writer thread would wait for itself
+	if (__sWriterStarted && !__sOnWriter) {
+		if (__sStagesPending > 0)
+			ASLogStageSweep(YES);
+		while (!ASLogLanesEmpty(NO)) {
+			ASLogWakeWriter(YES);
+			pthread_mutex_lock(&__sWakeLock);
+			ASLogDeadline(&until, 10000);
+			pthread_cond_timedwait(&__sDrainedCond, &__sWakeLock, &until);
+			pthread_mutex_unlock(&__sWakeLock);
+		}
+	}
+	ASLogSinksFlush();
+}
+
+/*!
+ @brief atexit() handler, so that lines still queued at exit are not lost.
+ */
+static void ASLogAsyncExit(void)
+{
+	ASLogAsyncFlush();
+}
+
+
+/*!
+ @brief pthread_atfork() prepare handler.
+ 
+ Takes every lock the logging path uses, so that the child does not inherit one held
+ by a thread that does not exist there, or a lane halfway through an update.
+ */
+static void ASLogForkPrepare(void)
+{
+	int i;
+	
+	pthread_mutex_lock(&__sStartLock);
+	pthread_mutex_lock(&__sSiteLock);
+	pthread_mutex_lock(&__sFormatLock);
+	pthread_mutex_lock(&__sFormatterLock);
+	pthread_mutex_lock(&__sStageLock);
+	pthread_mutex_lock(&__sPoolLock);
+	pthread_mutex_lock(&__sWarningLane.lock);
+	for (i = 0; i < __sBulkLaneCount; i++)
+		pthread_mutex_lock(&__sBulkLanes[i].lock);
+	pthread_mutex_lock(&__sWakeLock);
+}
+
+
+/*!
+ @brief pthread_atfork() parent handler, releases the locks taken before the fork.
+ */
+static void ASLogForkParent(void)
+{
+	int i;
+	
+	pthread_mutex_unlock(&__sWakeLock);
+	for (i = __sBulkLaneCount - 1; i >= 0; i--)
+		pthread_mutex_unlock(&__sBulkLanes[i].lock);
+	pthread_mutex_unlock(&__sWarningLane.lock);
+	pthread_mutex_unlock(&__sPoolLock);
+	pthread_mutex_unlock(&__sStageLock);
+	pthread_mutex_unlock(&__sFormatterLock);
+	pthread_mutex_unlock(&__sFormatLock);
+	pthread_mutex_unlock(&__sSiteLock);
+	pthread_mutex_unlock(&__sStartLock);
+}
+
+
+/*!
+ @brief Resets a lane in a forked child.
+ 
+ Lines still queued belong to the parent, whose writer thread writes them, so the 
+ child starts with an empty lane rather than writing them a second time.
+ */
+static void ASLogLaneReset(ASLogLane *lane)
+{
+	ASLogRecord *record;
+	
+	pthread_mutex_init(&lane->lock, NULL);
+	pthread_cond_init(&lane->space, NULL);
+	lane->tail = lane->head;
+	lane->waiters = 0;
+	lane->dropped = 0;
+	while (lane->records != NULL) {
+		record = lane->records;
+		lane->records = record->next;
+		ASLogPoolReturn(record);
+	}
+	lane->lastRecord = NULL;
+}
+
+
+/*!
+ @brief pthread_atfork() child handler.
+ 
+ The child has only the thread that called fork(), so the locks and condition
+ variables are set up afresh, the lanes emptied and a new writer thread started. If 
+ that fails output falls back to synchronous. The stderr file descriptor is shared
+ with the parent, a log file opened by +switchLoggingToFile:fromAppDir: is in append
+ mode so each process's lines still land whole at its end.
+ 
+ The other threads' stages and record pools have no owner in the child and are freed.
+ Once the lanes have handed their records back the only record of another pool still
+ out is one the parent's writer thread was writing, which is let go with it.
+ */
+static void ASLogForkChild(void)
+{
+	pthread_t thread;
+	ASLogStage *stage, *next, *own = pthread_getspecific(__sStageKey);
+	ASLogPool *pool, *nextPool, *ownPool = pthread_getspecific(__sPoolKey);
+	int i;
+	
+	pthread_mutex_init(&__sStartLock, NULL);
+	pthread_mutex_init(&__sSiteLock, NULL);
+	pthread_mutex_init(&__sFormatLock, NULL);
+	pthread_mutex_init(&__sFormatterLock, NULL);
+	pthread_mutex_init(&__sStageLock, NULL);
+	pthread_mutex_init(&__sPoolLock, NULL);
+	// the parent writes what was staged, the other threads' stages have no owner now
+	for (stage = __sStages; stage != NULL; stage = next) {
+		next = stage->next;
+		if (stage != own) {
+			free(stage);
+			ASLogMemoryRelease(ASLogMemoryStaging, sizeof(ASLogStage));
+		}
+	}
+	__sStages = own;
+	if (own != NULL) {
+		pthread_mutex_init(&own->lock, NULL);
+		own->next = NULL;
+		own->length = 0;
+		own->lines = 0;
+	}
+	__sStagesPending = 0;
+	pthread_mutex_init(&__sWakeLock, NULL);
+	pthread_cond_init(&__sWakeCond, NULL);
+	pthread_cond_init(&__sDrainedCond, NULL);
+	ASLogLaneReset(&__sWarningLane);
+	for (i = 0; i < __sBulkLaneCount; i++)
+		ASLogLaneReset(&__sBulkLanes[i]);
+	// after the lanes, so their records are back on the free lists
+	for (pool = __sPools; pool != NULL; pool = nextPool) {
+		nextPool = pool->next;
+		if (pool != ownPool) {
+			ASLogPoolCollect(pool);
+			ASLogPoolTrim(pool);
+			free(pool);
+		}
+	}
+	__sPools = ownPool;
+	if (ownPool != NULL)
+		ownPool->next = NULL;
+	__sWriterParked = ASLogWriterRunning;
+	__sWriterSettingsChanged = YES;
+	
+	if (pthread_create(&thread, NULL, ASLogWriterMain, NULL) == 0) {
+		pthread_detach(thread);
+	} else {
+		__sAsyncOn = NO;
+		__sWriterStarted = NO;
+	}
+}
+
+
+/*!
+ @brief Allocates the lanes and starts the writer thread, once.
+ 
+ Also installs the fork handlers, so a pre-forking server's workers each get their 
+ own writer thread.
+ 
+ @return NO if that was not possible, in which case output stays synchronous.
+ */
+static BOOL ASLogAsyncStart(void)
+{
+	static BOOL forkHandlers = NO;
+	pthread_t thread;
+	size_t warningSize = __sAsyncQueueSize / 16;
+	int i, count;
+	
+	pthread_mutex_lock(&__sStartLock);
+	if (!__sWriterStarted) {
+		if (warningSize < 64 * 1024)
+			warningSize = 64 * 1024;
+		if (__sWarningLane.bytes == NULL
+			&& !ASLogLaneInit(&__sWarningLane, warningSize, YES, -1)) {
+			pthread_mutex_unlock(&__sStartLock);
+			return NO;
+		}
+		count = (__sAsyncNUMAOn ? ASLogNodeCount() : 1);
+		for (i = 0; i < count; i++) {
+			if (__sBulkLanes[i].bytes == NULL
+				&& !ASLogLaneInit(&__sBulkLanes[i], __sAsyncQueueSize, NO, (count > 1 ? i : -1))) {
+				pthread_mutex_unlock(&__sStartLock);
+				return NO;
+			}
+			// only count lanes once they are set up, the writer reads this unlocked
+			__sBulkLaneCount = i + 1;
+		}
+		if (pthread_create(&thread, NULL, ASLogWriterMain, NULL) == 0) {
+			pthread_detach(thread);
+			if (!forkHandlers) {
+				atexit(ASLogAsyncExit);
+				pthread_atfork(ASLogForkPrepare, ASLogForkParent, ASLogForkChild);
+				forkHandlers = YES;
+			}
+			__sWriterStarted = YES;
+		}
+	}
+	pthread_mutex_unlock(&__sStartLock);
+	return __sWriterStarted;
+}
+
+#pragma mark Destinations
+
+/*!
+ @brief Points stderr at another open descriptor.
+ 
+ Anything queued for asynchronous output, and anything stdio has buffered, goes out 
+ to the old destination first. dup2() then swaps the descriptor in one step, so 
+ every thread writing stderr moves over together.
+ 
+ @param fd - descriptor to duplicate onto stderr.
+ 
+ @return NO if dup2() failed, output still goes where it did.
+ */
+static BOOL ASLogSetDestination(int fd)
+{
+	int result;
+	
+	ASLogAsyncFlush();
+	fflush(stderr);
+	do {
+		result = dup2(fd, fileno(stderr));
+	} while (result < 0 && errno == EINTR);
+	return (result >= 0);
+}
+
+#pragma mark Output
+
+/*!
+ @brief Outputs a formatted message through the current logging function, laid out by 
+ the prefix pattern, see ASLogFormatPrefix().
+ 
+ The time taken is fed to load shedding, see ASLogShedRecord().
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file, or NULL
+ to output the message unadorned.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function,
+ or NULL to leave it out.
+ 
+ @param print - the message.
+ */
+static void ASLogOutputString(ASLogLevel level, const char *sourceFile, int lineNumber, const char *functionName, NSString *print)
+{
+	char prefix[PATH_MAX + 256];
+	struct iovec suffix;
+	uint64_t start = ASLogNow();
+	
+	ASLogFormatPrefix(prefix, sizeof(prefix), level, sourceFile, lineNumber, functionName, NO, &suffix);
+	__sCurLogFunc(@"%s%@%s", prefix, print, (const char *)suffix.iov_base);
+	ASLogShedRecord(start);
+}
+
+
+/*!
+ @brief Outputs a finished message, or in asynchronous mode queues it for the writer 
+ thread.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file, or NULL.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function, or NULL.
+ 
+ @param buffer - the message, finished by ASLogBufferFinish().
+ */
+static void ASLogOutputBuffer(ASLogLevel level, const char *sourceFile, int lineNumber, const char *functionName, 
+							  ASLogBuffer *buffer)
+{
+	NSString *print;
+	char prefix[PATH_MAX + 256];
+	struct iovec iov[4];
+	ASLogBuffer *expanded;
+	
+	if (buffer->objectCount > 0) {
+		if (__sAsyncOn && ASLogAsyncEnqueueObjects(level, sourceFile, lineNumber, functionName, buffer))
+			return;
+		// asynchronous output was turned off meanwhile, or the pools are out of budget
+		expanded = ASLogBufferAcquire();
+		if (expanded == NULL) {
+			ASLogBufferExpandInPlace(buffer);
+		} else {
+			ASLogBufferExpand(expanded, buffer->bytes, buffer->length, buffer->objects, buffer->objectCount, 
+							  buffer->truncated, buffer->trailer);
+			buffer->objectCount = 0;
+			ASLogOutputBuffer(level, sourceFile, lineNumber, functionName, expanded);
+			ASLogBufferRelease(expanded);
+			return;
+		}
+	}
+	if (__sAsyncOn) {
+		iov[0].iov_base = prefix;
+		iov[0].iov_len = ASLogFormatPrefix(prefix, sizeof(prefix), level, sourceFile, lineNumber, functionName, YES, &iov[2]);
+		iov[1].iov_base = buffer->bytes;
+		iov[1].iov_len = buffer->length;
+		iov[3].iov_base = "\n";
+		iov[3].iov_len = 1;
+		ASLogAsyncEnqueue(level, iov, 4);
+	} else {
+		print = ASLogBufferCopyString(buffer);
+		ASLogOutputString(level, sourceFile, lineNumber, functionName, print);
+		[print release];
+	}
+}
+
+
+/*!
+ @brief Outputs a notice from ASLog itself, unadorned, as a normal line.
+ 
+ Notices go the way a logged line does: in asynchronous mode they are queued and 
+ written in their place among the lines around them, to the circular file and the 
+ sinks too, otherwise they go through the current logging function. They are neither
+ shed nor throttled.
+ 
+ @param format - NSString * holding the format of the notice.
+ */
+static void ASLogNotice(NSString *format, ...)
+{
+	ASLogBuffer *buffer = ASLogBufferAcquire();
+	va_list ap;
+	
+	if (buffer == NULL)
+		return;
+	va_start(ap, format);
+	ASLogFormatV(buffer, format, ap);
+	va_end(ap);
+	ASLogOutputBuffer(ASLogLevelNormal, NULL, 0, NULL, buffer);
+	ASLogBufferRelease(buffer);
+}
+
+
+/*!
+ @brief Formats and outputs a log line, the common body of the debug, normal and 
+ warning logging methods.
+ 
+ Lines of a level being shed because output is slow are dropped first, see 
+ ASLogShedAllows(), then lines from a call site that is logging too fast, see 
+ ASLogSiteAllows(). The message is formatted into the thread's bounded buffer, see 
+ ASLogFormatV(). If asked for, the return addresses of the caller's stack are captured with backtrace() 
+ and appended to the message, unsymbolized. The line is then output by 
+ ASLogOutputBuffer(). Never inlined, so that the frames to skip are always this 
+ function and the ASLog method that called it.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file, or NULL.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function, or NULL.
+ 
+ @param withBacktrace - BOOL, YES to append the caller's backtrace.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ap - the arguments for format.
+ */
+static __attribute__((noinline)) void ASLogOutputV(ASLogLevel level, const char *sourceFile, int lineNumber, const char *functionName, 
+												   BOOL withBacktrace, NSString *format, va_list ap)
+{
+	ASLogBuffer *buffer;
+	void *frames[ASLogBacktraceDepth + 2];
+	int frameCount;
+	
+	if (!ASLogShedAllows(level))
+		return;
+	// any other format could be freed and its address reused for different text
+	if ((sourceFile != NULL || [format class] == __sConstantStringClass)
+		&& !ASLogSiteAllows((sourceFile != NULL ? (const void *)sourceFile : (const void *)format), lineNumber))
+		return;
+	buffer = ASLogBufferAcquire();
+	if (buffer == NULL)
+		return;
+	buffer->deferring = (__sAsyncOn && __sDeferDescriptionsOn);
+	ASLogFormatV(buffer, format, ap);
+	if (withBacktrace) {
+		frameCount = backtrace(frames, ASLogBacktraceDepth + 2);
+		ASLogOutputImageMap();
+		if (frameCount > 2)
+			ASLogBufferAppendBacktrace(buffer, frames + 2, frameCount - 2);
+	}
+	ASLogOutputBuffer(level, sourceFile, lineNumber, functionName, buffer);
+	ASLogBufferRelease(buffer);
+}
+
+
+#pragma mark C interface
+
+/*!
+ @brief Logs a line from the C logging macros, see ASLogC.h.
+ 
+ Lines are dropped as by ASLogOutputV(). In asynchronous mode the arguments are 
+ queued as they are and formatted by the writer thread, see 
+ ASLogAsyncEnqueueValues(), otherwise, or if the pools are out of budget, the line 
+ is formatted here, see ASLogCFormat().
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling function, or NULL.
+ 
+ @param site - the call site, made by the macro.
+ 
+ @param values - its arguments, as many as the site has.
+ */
+void ASLogCWrite (ASLogLevel level, const char *sourceFile, int lineNumber, const char *functionName,
+				  const ASLogCSite *site, const ASLogCValue *values)
+{
+	NSAutoreleasePool *pool;
+	ASLogBuffer *buffer;
+	
+	if (level == ASLogLevelDebug && __sDebugLoggingOn == NO)
+		return;
+	if (!ASLogShedAllows(level) || !ASLogSiteAllows(sourceFile, lineNumber))
+		return;
+	if (__sAsyncOn && ASLogAsyncEnqueueValues(level, sourceFile, lineNumber, functionName, site, values))
+		return;
+	
+	// C callers need not have an autorelease pool
+	pool = [[NSAutoreleasePool alloc] init];
+	buffer = ASLogBufferAcquire();
+	if (buffer != NULL) {
+		ASLogCFormat(buffer, site, values);
+		ASLogOutputBuffer(level, sourceFile, lineNumber, functionName, buffer);
+		ASLogBufferRelease(buffer);
+	}
+	[pool release];
+}
+
+
+#pragma mark Implementation starts here.
+
+@implementation ASLog
+
+#pragma mark Object management methods
+
+/*!
+ @brief Initialise our static variables
+ 
+ ** NEVER CALL THIS PROGRAMMATICALLY **
+ 
+ Method called once (and only once!) before a class object is used for the first time.
+ 
+ Required because the class object is not programmatically instantiated with an 
+ alloc/init pair and so would not otherwise get a chance to do any one time set up
+ (as in this example, initialising static variables.
+ 
+ This method tests whether to allow logging from the debug logging methods by testing two 
+ conditions:
+ 
+	 - Is the DEBUG_LOG_AUTO_ENABLE macro defined
+	 - Is the environment variable NSDebugEnabled set to "YES"
+ 
+ If either of these is true then it sets the static BOOL __sDebugLoggingOn to YES and
+ so enables debug logging.
+ 
+ In addition it checks whether DEBUG_LOG_QUIET_ENABLE is defined and if it is sets 
+ __sCurLogFunc to point to QuietLog(), otherwise it points the variable at NSLog()
+ 
+ It creates the key for the per-thread buffers log messages are formatted into.
+ 
+ The method also saves a duplicate of the stderr descriptor on entry to preserve it for
+ later restoration if the output stream is changed.
+ 
+ */
++ (void) initialize
+{
+	// If DEBUG_LOG_AUTO_ENABLE is defined enable debug logging, irrespective of NSDebugEnabled
+	#ifdef DEBUG_LOG_AUTO_ENABLE
+		__sDebugLoggingOn = YES;
+	#endif
+	
+	// If the environment var NSDebugEnabled is YES, enable debug logging
+    char *env = getenv("NSDebugEnabled");
+    env = (env == NULL ? "" : env);
+    if(strcmp(env, "YES") == 0)
+        __sDebugLoggingOn = YES;
+	
+	// initialise the logging function selection static boolean
+	#ifdef DEBUG_LOG_QUIET_ENABLE
+		__sCurLogFunc = QuietLog;
+	#else
+		__sCurLogFunc = NSLog;
+	#endif
+	__sPlainLogFunc = __sCurLogFunc;
+	
+	// one format buffer per thread, freed as the thread exits
+	pthread_key_create(&__sBufferKey, ASLogBufferFree);
+	pthread_key_create(&__sPoolKey, ASLogPoolOrphan);
+	pthread_key_create(&__sStageKey, ASLogStageFree);
+	
+	__sPrefixProgram = ASLogPrefixProgramFor(ASLogDefaultPrefixPattern);
+	__sProcessID = getpid();
+	__sConstantStringClass = [@"" class];
+	pthread_atfork(NULL, NULL, ASLogPrefixForked);
+	
+	// Save the current stderr output for later use
+	__sStdErrSaved = fcntl(fileno(stderr), F_DUPFD_CLOEXEC, 0);
+	
+}
+
+#pragma mark Debug logging methods
+
+/*!
+ A simple substitute for NSLog(), called by the #ASDNSLog macro.
+ 
+ The macro could simply call NSLog with the same parameters but then we would loose
+ the ability to switch logging on or off.
+ 
+ Logging is controlled via the the static BOOL __sDebugLoggingOn which is in turn
+ controlled by the DEBUG_LOG_AUTO_ENABLE macro, the environment variable NSDebugEnabled
+ or the control method +setlogOn: Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)debugLog:(NSString *)format, ...;
+{
+    va_list ap;
+    if(__sDebugLoggingOn == NO)
+        return;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelDebug, NULL, 0, NULL, NO, format, ap);
+    va_end(ap);
+}
+
+
+/*!
+ Enhances NSLog, Called by the #ASDLog macro.
+ 
+ Calling this method via the macro enhances NSLog() by adding the source file name
+ and line number of the call to the log output.
+ 
+ Logging is controlled via the the static BOOL __sDebugLoggingOn which is in turn
+ controlled by the DEBUG_LOG_AUTO_ENABLE macro, the environment variable NSDebugEnabled
+ or the control method +setlogOn: Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)debugLog:(char *)sourceFile
+	  lineNumber:(int)lineNumber
+		  format:(NSString *)format, ...;
+{
+    va_list ap;
+    if(__sDebugLoggingOn == NO)
+        return;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelDebug, sourceFile, lineNumber, NULL, NO, format, ap);
+    va_end(ap);
+}
+
+
+/*!
+ Enhances NSLog, Called by the #ASDFnLog macro.
+ 
+ Calling this method via the macro enhances NSLog() by adding the source file name,
+ line number and the name of the calling method/function to the log output.
+ 
+ Logging is controlled via the the static BOOL __sDebugLoggingOn which is in turn
+ controlled by the DEBUG_LOG_AUTO_ENABLE macro, the environment variable NSDebugEnabled
+ or the control method +setlogOn: Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)debugLog:(char *)sourceFile
+	  lineNumber:(int)lineNumber
+		function:(char *)functionName
+		  format:(NSString *)format, ...;
+{
+    va_list ap;
+    if(__sDebugLoggingOn == NO)
+        return;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelDebug, sourceFile, lineNumber, functionName, NO, format, ap);
+    va_end(ap);
+}
+
+#pragma mark Release logging methods
+
+/*!
+ Basic NSLog, Called by the #ASNSLog macro.
+ 
+ Calling this method via the macro calls un-adorned  NSLog().
+ 
+ Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)log:(NSString *)format, ...;
+{
+    va_list ap;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelNormal, NULL, 0, NULL, NO, format, ap);
+    va_end(ap);
+}
+
+
+/*!
+ Enhances NSLog, Called by the #ASFlLog macro.
+ 
+ Calling this method via the macro enhances NSLog() by adding the source file name
+ and line number of the call to the log output.
+ 
+ Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)log:(char *)sourceFile
+	  lineNumber:(int)lineNumber
+		  format:(NSString *)format, ...;
+{
+    va_list ap;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelNormal, sourceFile, lineNumber, NULL, NO, format, ap);
+    va_end(ap);
+}
+
+
+/*!
+ Enhances NSLog, Called by the #ASFnLog macro.
+ 
+ Calling this method via the macro enhances NSLog() by adding the source file name,
+ line number and the name of the calling method/function to the log output.
+ 
+ Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)log:(char *)sourceFile
+	  lineNumber:(int)lineNumber
+		function:(char *)functionName
+		  format:(NSString *)format, ...;
+{
+    va_list ap;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelNormal, sourceFile, lineNumber, functionName, NO, format, ap);
+    va_end(ap);
+}
+
+#pragma mark Warning logging methods
+
+/*!
+ A simple substitute for NSLog(), called by the #ASNSWarn macro.
+ 
+ Calling this method via the macro enhances NSLog() by adding the tag "WARNING:" 
+ to the log output.
+ 
+ The macro could simply call NSLog with the same paramters but then we would loose
+ the "WARNING:" flag.
+ 
+ Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)warn:(NSString *)format, ...;
+{
+    va_list ap;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelWarning, NULL, 0, NULL, __sWarnBacktraceOn, format, ap);
+    va_end(ap);
+}
+
+
+/*!
+ An enhanced substitute for NSLog(), called by the #ASWarn macro.
+ 
+ Calling this method via the macro enhances NSLog() by adding the tag "WARNING:" and the
+ source file name and line number of the call to the log output.
+ 
+ Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)warn:(char *)sourceFile
+	  lineNumber:(int)lineNumber
+		  format:(NSString *)format, ...;
+{
+    va_list ap;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelWarning, sourceFile, lineNumber, NULL, __sWarnBacktraceOn, format, ap);
+    va_end(ap);
+}
+
+
+/*!
+ An enhanced substitute for NSLog(), called by the #ASWarn macro.
+ 
+ Calling this method via the macro enhances NSLog() by adding the tag "WARNING:" and the
+ source file name, line number and calling method/function name to the log output.
+ 
+ Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)warn:(char *)sourceFile
+	  lineNumber:(int)lineNumber
+		function:(char *)functionName
+		  format:(NSString *)format, ...;
+{
+    va_list ap;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelWarning, sourceFile, lineNumber, functionName, __sWarnBacktraceOn, format, ap);
+    va_end(ap);
+}
+
+
+/*!
+ A warning with a backtrace, called by the #ASWarnTrace macro.
+ 
+ As +warn:lineNumber:format: but the return addresses of the caller's stack are 
+ always appended to the log output, whatever +setWarnBacktraceOn: says. The addresses
+ are not symbolized, that is left to Tools/aslog-symbolize.
+ 
+ Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)warnTrace:(char *)sourceFile
+	   lineNumber:(int)lineNumber
+		   format:(NSString *)format, ...;
+{
+    va_list ap;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelWarning, sourceFile, lineNumber, NULL, YES, format, ap);
+    va_end(ap);
+}
+
+
+/*!
+ A warning with a backtrace, called by the #ASFnWarnTrace macro.
+ 
+ As +warn:lineNumber:function:format: but the return addresses of the caller's stack
+ are always appended to the log output, whatever +setWarnBacktraceOn: says. The 
+ addresses are not symbolized, that is left to Tools/aslog-symbolize.
+ 
+ Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
+ directed to.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param functionName - c-string pointer holding the name of the calling method/function.
+ 
+ @param format - NSString * that holds the formatting string for NSLog().
+ 
+ @param ...	- variadic argument list.
+ */
++ (void)warnTrace:(char *)sourceFile
+	   lineNumber:(int)lineNumber
+		 function:(char *)functionName
+		   format:(NSString *)format, ...;
+{
+    va_list ap;
+    va_start(ap, format);
+    ASLogOutputV(ASLogLevelWarning, sourceFile, lineNumber, functionName, YES, format, ap);
+    va_end(ap);
+}
+
+#pragma mark Binary logging methods
+
+/*!
+ Hex dump of a block of memory, called by the #ASLogHex macro.
+ 
+ The dump is written straight into a single buffer which becomes the logged string,
+ so logging binary data does not go through -description. Depending on the style
+ set by +setHexStyle: the output is either a classic offset/hex/ASCII dump or a run
+ of hex digits. At most the number of bytes set by +setHexLimit: are shown.
+ 
+ ASLogLevelDebug lines are controlled by __sDebugLoggingOn as for the debug logging
+ methods, ASLogLevelWarning lines are tagged "WARNING:". Logging is directed to 
+ whatever stream stderr is currently directed to.
+ 
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param bytes - pointer to the memory to dump.
+ 
+ @param length - number of bytes to dump.
+ */
++ (void)hexLog:(char *)sourceFile
+	lineNumber:(int)lineNumber
+		 level:(ASLogLevel)level
+		 bytes:(const void *)bytes
+		length:(NSUInteger)length
+{
+	const unsigned char *in = bytes;
+	NSUInteger shown, offset;
+	size_t capacity;
+	char *buffer, *out;
+	NSString *print;
+	char prefix[PATH_MAX + 256];
+	struct iovec iov[4];
+	
+	if (level == ASLogLevelDebug && __sDebugLoggingOn == NO)
+		return;
+	if (!ASLogShedAllows(level) || !ASLogSiteAllows(sourceFile, lineNumber))
+		return;
+	
+	shown = (__sHexLimit != 0 && length > __sHexLimit) ? __sHexLimit : length;
+	
+	// worst case size, 128 covers the byte count and truncation note, show less if
+	// that would go over the memory budget
+	for (;;) {
+		if (__sHexStyle == ASLogHexStyleCompact)
+			capacity = 128 + 2 * shown;
+		else
+			capacity = 128 + ((shown + 15) / 16) * 80;
+		if (ASLogMemoryReserve(ASLogMemoryHexDumps, capacity))
+			break;
+		if (shown <= 256)
+			return;
+		shown /= 2;
+	}
+	buffer = malloc(capacity);
+	if (buffer == NULL) {
+		ASLogMemoryRelease(ASLogMemoryHexDumps, capacity);
+		return;
+	}
+	
+	out = buffer + snprintf(buffer, 64, "%lu bytes", (unsigned long)length);
+	if (__sHexStyle == ASLogHexStyleCompact) {
+		*out++ = ':';
+		*out++ = ' ';
+		out = ASLogHexEncode(out, in, shown);
+	} else {
+		for (offset = 0; offset < shown; offset += 16) {
+			*out++ = '\n';
+			out = ASLogHexDumpLine(out, in + offset, (shown - offset < 16 ? shown - offset : 16), offset);
+		}
+	}
+	if (shown < length)
+		out += snprintf(out, 64, "%s... %lu more bytes", (__sHexStyle == ASLogHexStyleCompact ? " " : "\n"), 
+						(unsigned long)(length - shown));
+	
+	if (__sAsyncOn) {
+		iov[0].iov_base = prefix;
+		iov[0].iov_len = ASLogFormatPrefix(prefix, sizeof(prefix), level, sourceFile, lineNumber, NULL, YES, &iov[2]);
+		iov[1].iov_base = buffer;
+		iov[1].iov_len = out - buffer;
+		iov[3].iov_base = "\n";
+		iov[3].iov_len = 1;
+		ASLogAsyncEnqueue(level, iov, 4);
+		free(buffer);
+		ASLogMemoryRelease(ASLogMemoryHexDumps, capacity);
+		return;
+	}
+	
+	// the string takes ownership of the buffer
+	print = [[NSString alloc] initWithBytesNoCopy:buffer length:(out - buffer) encoding:NSASCIIStringEncoding freeWhenDone:YES];
+	ASLogOutputString(level, sourceFile, lineNumber, NULL, print);
+	[print release];
+	ASLogMemoryRelease(ASLogMemoryHexDumps, capacity);
+}
+
+
+/*!
+ Hex dump of the contents of an NSData, called by the #ASLogData macro.
  
- Function pointer - called by all the log...:/debugLog...:/warn...: methods to output their
- log text. Currently will be either NSLog() (the default) or QuietLog().
+ See +hexLog:lineNumber:level:bytes:length:
  
- QUietLog() can be selected at build time by defining the DEBUG_LOG_QUIET_ENABLE macro
- or programmatically with the +setQuietOn: method at runtime.
- */
-static void (*__sCurLogFunc)(NSString *format, ...);
-
-/*! Buffer to hold the path of the stderr stream on entry. Needed so we can restore
- stderr after redirection if required.
+ @param sourceFile - c-string pointer holding the name of the source file.
+ 
+ @param lineNumber - int holding the line number in the source file of the call.
+ 
+ @param level - ASLogLevel of the log line.
+ 
+ @param data - NSData * holding the bytes to dump.
  */
-static char __sStdErrPath[PATH_MAX+1];
++ (void)hexLog:(char *)sourceFile
+	lineNumber:(int)lineNumber
+		 level:(ASLogLevel)level
+		  data:(NSData *)data
+{
+	[self hexLog:sourceFile lineNumber:lineNumber level:level bytes:[data bytes] length:[data length]];
+}
 
 
 /*!
- \brief Optional quieter substitute for NSLog() for logging output.
+ Logs a formatted prefix followed by a caller owned buffer, called by the #ASLogPayload
+ macro.
  
- NSLog() is very noisy - all that date, time and process clutter beginning each line. 
- QuietLog() prints only what you ask it to.
+ Intended for large message bodies, which are not subject to +setMaxRecordLength:,
+ only the prefix is. The bytes are never copied into an NSString: when
+ QuietLog() is in use the prefix, the caller's buffer and the line end are handed to 
+ the kernel in a single writev() on stderr. In asynchronous mode they are copied once,
+ straight into the queue. NSLog() has to format its own header so 
+ in that case the buffer is wrapped, uncopied, in an NSString for the one format NSLog()
+ does. The buffer is expected to hold UTF-8 text, anything else is logged as Latin-1.
  
- QuietLog() has one significant difference to NSLog(). NSLog() output is intercepted by 
- the system and sent to /var/log/system.log. Logging is only directed to whatever stream 
- stderr is currently directed to.
+ ASLogLevelDebug lines are controlled by __sDebugLoggingOn as for the debug logging
+ methods, ASLogLevelWarning lines are tagged "WARNING:". Logging is directed to 
+ whatever stream stderr is currently directed to.
  
- The ASLog logging/warning methods can be switched to use QuietLog() thse ways:
+ @param sourceFile - c-string pointer holding the name of the source file.
  
-	Programmatically: call the +setQuietOn: class method
-	
-	At compile time by defining the DEBUG_LOG_QUIET_ENABLE macro
+ @param lineNumber - int holding the line number in the source file of the call.
  
- QuietLog() created by Mark Dalrymple @ Big Nerd Ranch
- <https://www.bignerdranch.com/blog/a-quieter-log/>
+ @param level - ASLogLevel of the log line.
  
- @param format - NSString * that holds the formatting string (vide NSLog()).
+ @param bytes - pointer to the caller's buffer, need only be valid for the call.
+ 
+ @param length - number of bytes in the buffer.
+ 
+ @param format - NSString * that holds the formatting string for the prefix.
  
  @param ...	- variadic argument list.
  */
-void QuietLog (NSString *format, ...)
++ (void)payloadLog:(char *)sourceFile
+		lineNumber:(int)lineNumber
+			 level:(ASLogLevel)level
+			 bytes:(const void *)bytes
+			length:(NSUInteger)length
+			format:(NSString *)format, ...
 {
-    va_list argList;
-    va_start (argList, format);
-	
-    NSString *message = [[NSString alloc] initWithFormat: format
-											   arguments: argList];
-	
-	// no ARC in this build so...
-	[message autorelease];
+    va_list ap;
+	ASLogBuffer *buffer;
+    NSString *print, *payload;
+	char location[PATH_MAX + 256];
+	struct iovec iov[6];
+	uint64_t start;
 	
-    va_end (argList);
+	if (level == ASLogLevelDebug && __sDebugLoggingOn == NO)
+		return;
+	if (!ASLogShedAllows(level) || !ASLogSiteAllows(sourceFile, lineNumber))
+		return;
+	buffer = ASLogBufferAcquire();
+	if (buffer == NULL)
+		return;
+    va_start(ap, format);
+    ASLogFormatV(buffer, format, ap);
+    va_end(ap);
 	
-    fprintf (stderr, "%s\n", [message UTF8String]);
+	start = ASLogNow();
+	if (__sAsyncOn || __sCurLogFunc == QuietLog || __sCurLogFunc == ASLogHeaderLog) {
+		iov[0].iov_base = location;
+		iov[0].iov_len = ASLogFormatPrefix(location, sizeof(location), level, sourceFile, lineNumber, NULL, YES, &iov[4]);
+		iov[1].iov_base = buffer->bytes;
+		iov[1].iov_len = buffer->length;
+		iov[2].iov_base = " ";
+		iov[2].iov_len = 1;
+		iov[3].iov_base = (void *)bytes;
+		iov[3].iov_len = length;
+		iov[5].iov_base = "\n";
+		iov[5].iov_len = 1;
+		
+		if (__sAsyncOn) {
+			// copied once, straight into the queue
+			ASLogAsyncEnqueue(level, iov, 6);
+		} else {
+			// anything QuietLog() has buffered must go out first
+			fflush(stderr);
+			ASLogEmit(iov, 6);
+		}
+	} else {
+		payload = [[NSString alloc] initWithBytesNoCopy:(void *)bytes length:length encoding:NSUTF8StringEncoding freeWhenDone:NO];
+		if (payload == nil)
+			payload = [[NSString alloc] initWithBytesNoCopy:(void *)bytes length:length encoding:NSISOLatin1StringEncoding freeWhenDone:NO];
+		print = ASLogBufferCopyString(buffer);
+		
+		ASLogFormatPrefix(location, sizeof(location), level, sourceFile, lineNumber, NULL, NO, &iov[4]);
+		__sCurLogFunc(@"%s%@ %@%s", location, print, payload, (const char *)iov[4].iov_base);
+		
+		[print release];
+		[payload release];
+	}
+	ASLogShedRecord(start);
 	
+	ASLogBufferRelease(buffer);
 }
 
-
-#pragma mark Implementation starts here.
-
-@implementation ASLog
-
-#pragma mark Object management methods
+#if defined(__BLOCKS__)
+#pragma mark Deferred logging methods
 
 /*!
- @brief Initialise our static variables
+ @brief Logs the message a block returns, only running the block if the line is 
+ logged. Called by the #ASLogLazy, #ASLogLazyOnWriter, #ASDLogLazy and 
+ #ASDLogLazyOnWriter macros.
  
- ** NEVER CALL THIS PROGRAMMATICALLY **
+ Nothing is done for a debug line while debug logging is off, nor for a line that 
+ load shedding or throttling would drop, so an expensive message costs nothing 
+ unless it is logged. With onWriter in asynchronous mode the block is copied and 
+ queued, and run on the writer thread just before its line is written; it should 
+ then only use values it has captured that no other thread changes. If the record 
+ pools are out of budget, or output is synchronous, the block runs here.
  
- Method called once (and only once!) before a class object is used for the first time.
+ @param sourceFile - c-string pointer holding the name of the source file.
  
- Required because the class object is not programmatically instantiated with an 
- alloc/init pair and so would not otherwise get a chance to do any one time set up
- (as in this example, initialising static variables.
+ @param lineNumber - int holding the line number in the source file of the call.
  
- This method tests whether to allow logging from the debug logging methods by testing two 
- conditions:
+ @param level - ASLogLevel of the log line.
  
-	 - Is the DEBUG_LOG_AUTO_ENABLE macro defined
-	 - Is the environment variable NSDebugEnabled set to "YES"
+ @param onWriter - BOOL, YES to run the block on the writer thread in asynchronous mode.
  
- If either of these is true then it sets the static BOOL __sDebugLoggingOn to YES and
- so enables debug logging.
+ @param block - returns the message, must not throw.
+ */
++ (void)lazyLog:(char *)sourceFile
+	 lineNumber:(int)lineNumber
+		  level:(ASLogLevel)level
+	   onWriter:(BOOL)onWriter
+		  block:(NSString *(^)(void))block
+{
+	ASLogBuffer *buffer;
+	
+	if (level == ASLogLevelDebug && __sDebugLoggingOn == NO)
+		return;
+	if (!ASLogShedAllows(level) || !ASLogSiteAllows(sourceFile, lineNumber))
+		return;
+	if (onWriter && __sAsyncOn && ASLogAsyncEnqueueDeferred(level, sourceFile, lineNumber, block))
+		return;
+	buffer = ASLogBufferAcquire();
+	if (buffer == NULL)
+		return;
+	ASLogBufferAppendObject(buffer, block(), 0);
+	ASLogBufferFinish(buffer);
+	ASLogOutputBuffer(level, sourceFile, lineNumber, NULL, buffer);
+	ASLogBufferRelease(buffer);
+}
+#endif
+
+#pragma mark Control methods
+
+/*!
+ Programmatic control of logging for the debug logging methods.
  
- In addition it checks whether DEBUG_LOG_QUIET_ENABLE is defined and if it is sets 
- __sCurLogFunc to point to QuietLog(), otherwise it points the variable at NSLog()
+ Even if logging is not enabled via the DEBUG_LOG_AUTO_ENABLE macro or the environment
+ variable NSDebugEnabled you can enable/disable it at runtime with this call.
  
- The method also saves the output stream for stderr on entry to preserve it for later 
- restoration if the output stream is changed.
+ This has no effect on the "Normal" or "Warning" logging methods and will have no
+ effect if the debugging macros have been compiled out because the BUILD_WITH_DEBUG_LOGGING
+ macro was not defined.
  
+ @param logOn - BOOL, if YES then logging is enabled
  */
-+ (void) initialize
++ (void) setLogOn: (BOOL) logOn
 {
-	// If DEBUG_LOG_AUTO_ENABLE is defined enable debug logging, irrespective of NSDebugEnabled
-	#ifdef DEBUG_LOG_AUTO_ENABLE
-		__sDebugLoggingOn = YES;
-	#endif
-	
-	// If the environment var NSDebugEnabled is YES, enable debug logging
-    char *env = getenv("NSDebugEnabled");
-    env = (env == NULL ? "" : env);
-    if(strcmp(env, "YES") == 0)
-        __sDebugLoggingOn = YES;
+    __sDebugLoggingOn=logOn;
+}
+
+
+/*!
+ @brief Programmatic control of use of QuietLog() or NSLog().
+ 
+ Switched the logging/warning methods between using NSLog() and QuietLog().
+ The latter behaves exactly the same as NSLog() except:
+ 
+	it is not intercepted and sent to /var/log/system.log
 	
-	// initialise the logging function selection static boolean
-	#ifdef DEBUG_LOG_QUIET_ENABLE
+	it does not prepend the log line with all that date/time/process mess.
+ 
+ @param quietOn - BOOL, if YES then logging functions will call QuietLog()
+ */
++ (void) setQuietOn: (BOOL) quietOn
+{
+	if (quietOn) {
 		__sCurLogFunc = QuietLog;
-	#else
+	} else {
 		__sCurLogFunc = NSLog;
-	#endif
-	
-	// Save the current stderr output for later use
-	int fd;
-	fd = fileno(stderr);
-	fcntl(fd, F_GETPATH, &__sStdErrPath);
+	}
+	__sPlainLogFunc = __sCurLogFunc;
+}
+
+
+/*!
+ @brief Switches the logging methods to a fast stand-in for NSLog().
+ 
+ Lines start with exactly the header NSLog() writes, "2026-10-18 14:03:27.512 
+ MyApp[1234:5678] ", so tools that parse NSLog() output keep working, but it is put 
+ together from cached values and written in a single write, see ASLogHeaderLog(). 
+ Asynchronous output and the binary methods get the header too. Unlike NSLog() 
+ nothing goes to the system log. +setQuietOn: switches back to NSLog() or QuietLog().
+ 
+ @param headerOn - BOOL, YES to log through ASLogHeaderLog(), NO to go back to 
+ whichever of NSLog() and QuietLog() was in use before.
+ */
++ (void)setNSLogHeaderOn:(BOOL)headerOn
+{
+	if (headerOn) {
+		if (__sProcessName == NULL)
+			__sProcessName = strdup([[[NSProcessInfo processInfo] processName] UTF8String]);
+		__sCurLogFunc = ASLogHeaderLog;
+	} else {
+		__sCurLogFunc = __sPlainLogFunc;
+	}
+}
+
+
+/*!
+ @brief Sets the pattern every log line is laid out with.
+ 
+ The pattern is compiled once, here, so lines are laid out without looking at it 
+ again. Text is copied as it stands, %% for a '%'. The conversions are:
+ 
+	%T	local date and time, "2026-10-18 14:03:27.512"
+	%L	level, DEBUG, NORMAL or WARNING
+	%W	"WARNING: " on warnings, nothing otherwise
+	%t	system thread ID
+	%f	source file name
+	%l	line number in the source file
+	%F	calling method/function
+	%m	the message, at the end if left out
+ 
+ Text between %[ and %] is left out of lines logged without a source file or 
+ function used inside it, so "%[%f:%l %]" disappears for the unadorned methods. 
+ The default is "%W%[%f:%l %]%[in %F %]%m". NSLog() still adds its own header when
+ quiet logging is off.
+ 
+ Each pattern is compiled once and kept, under the memory budget: switching back to 
+ a pattern used before costs nothing.
+ 
+ @param pattern - NSString * holding the pattern, nil for the default.
+ 
+ @return YES if the pattern is in use, NO if it is not valid or the memory budget will
+ not allow it, and the old one is kept.
+ */
++ (BOOL)setPrefixPattern:(NSString *)pattern
+{
+	ASLogPrefixProgram *program;
 	
+	program = ASLogPrefixProgramFor(pattern == nil ? ASLogDefaultPrefixPattern : [pattern UTF8String]);
+	if (program == NULL)
+		return NO;
+	__sync_lock_test_and_set(&__sPrefixProgram, program);
+	return YES;
 }
 
-#pragma mark Debug logging methods
 
 /*!
- A simple substitute for NSLog(), called by the #ASDNSLog macro.
+ @brief Registers a function that appends instances of a class, and its subclasses, 
+ to log messages in place of -description.
  
- The macro could simply call NSLog with the same parameters but then we would loose
- the ability to switch logging on or off.
+ For classes that cannot adopt ASLogFormattable themselves. A formatter registered 
+ for a class wins over one for its superclass and over ASLogFormattable. Registering
+ again for the same class replaces the formatter, NULL goes back to -description.
+ Takes effect for classes already logged too.
  
- Logging is controlled via the the static BOOL __sDebugLoggingOn which is in turn
- controlled by the DEBUG_LOG_AUTO_ENABLE macro, the environment variable NSDebugEnabled
- or the control method +setlogOn: Logging is directed to whatever stream stderr is currently
- directed to.
+ Strings, data, arrays, sets and dictionaries are always appended by ASLog itself, 
+ a formatter for one of them, or a subclass, would never be called and is refused.
  
- @param format - NSString * that holds the formatting string for NSLog().
+ @param formatter - ASLogFormatter, writes the object into the message with the 
+ ASLogAppend...() functions.
  
- @param ...	- variadic argument list.
+ @param aClass - the class.
+ 
+ @return YES if registered, NO if aClass is one ASLog appends itself or 
+ ASLogMaxFormatters are already registered.
  */
-+ (void)debugLog:(NSString *)format, ...;
++ (BOOL)registerFormatter:(ASLogFormatter)formatter forClass:(Class)aClass
 {
-    va_list ap;
-    NSString *print;
-    if(__sDebugLoggingOn == NO)
-        return;
-    va_start(ap, format);
-    print = [[NSString alloc] initWithFormat:format arguments:ap];
-    va_end(ap);
-    
-    __sCurLogFunc(@"%@", print);
-    
-    [print release];
+	int i;
+	
+	if ([aClass isSubclassOfClass:[NSString class]] || [aClass isSubclassOfClass:[NSData class]]
+		|| [aClass isSubclassOfClass:[NSArray class]] || [aClass isSubclassOfClass:[NSSet class]] 
+		|| [aClass isSubclassOfClass:[NSDictionary class]])
+		return NO;
+	pthread_mutex_lock(&__sFormatterLock);
+	for (i = 0; i < __sFormatterCount; i++)
+		if (__sFormatterClasses[i] == aClass)
+			break;
+	if (i == ASLogMaxFormatters) {
+		pthread_mutex_unlock(&__sFormatterLock);
+		return NO;
+	}
+	__sFormatters[i] = formatter;
+	__sFormatterClasses[i] = aClass;
+	if (i == __sFormatterCount)
+		__sFormatterCount++;
+	
+	// classes already seen may inherit the formatter
+	for (i = 0; i < ASLogClassTableSize; i++)
+		if (__sClassFormatters[i].key != Nil)
+			ASLogClassEntryStore(&__sClassFormatters[i], __sClassFormatters[i].key,
+				ASLogClassResolve(__sClassFormatters[i].key));
+	pthread_mutex_unlock(&__sFormatterLock);
+	return YES;
 }
 
 
 /*!
- Enhances NSLog, Called by the #ASDLog macro.
+ @brief Selects the layout used by the hexLog...: methods.
  
- Calling this method via the macro enhances NSLog() by adding the source file name
- and line number of the call to the log output.
+ @param hexStyle - ASLogHexStyle, ASLogHexStyleDump (the default) for an offset/hex/ASCII
+ dump, ASLogHexStyleCompact for a single run of hex digits.
+ */
++ (void)setHexStyle:(ASLogHexStyle)hexStyle
+{
+	__sHexStyle = hexStyle;
+}
+
+
+/*!
+ @brief Sets the maximum number of bytes shown by the hexLog...: methods.
  
- Logging is controlled via the the static BOOL __sDebugLoggingOn which is in turn
- controlled by the DEBUG_LOG_AUTO_ENABLE macro, the environment variable NSDebugEnabled
- or the control method +setlogOn: Logging is directed to whatever stream stderr is currently
- directed to.
+ Bytes past the limit are not dumped, their count is logged instead. The default is 4096.
  
- @param sourceFile - c-string pointer holding the name of the source file.
+ @param hexLimit - NSUInteger, maximum number of bytes to dump. 0 means no limit.
+ */
++ (void)setHexLimit:(NSUInteger)hexLimit
+{
+	__sHexLimit = hexLimit;
+}
+
+
+/*!
+ @brief Programmatic control of backtraces on warnings.
  
- @param lineNumber - int holding the line number in the source file of the call.
+ When on, every warn...: method appends the return addresses of the caller's stack
+ to its output. Capturing them is cheap, they are not symbolized in-process. Before
+ the first backtrace, and again whenever libraries have been loaded since, a map of 
+ the loaded images is logged so Tools/aslog-symbolize can symbolize the log later.
  
- @param format - NSString * that holds the formatting string for NSLog().
+ @param warnBacktraceOn - BOOL, if YES then warnings include a backtrace
+ */
++ (void)setWarnBacktraceOn:(BOOL)warnBacktraceOn
+{
+	__sWarnBacktraceOn = warnBacktraceOn;
+}
+
+
+/*!
+ @brief Sets the rate above which a single call site is throttled.
  
- @param ...	- variadic argument list.
+ Every call site, that is every ASLog macro in the source, counts the lines it logs 
+ each second. One that logs more than this in a second is switched to logging 1 line 
+ in the number set by +setThrottledSampleRate: and a notice is logged. When its rate
+ drops back below the limit it logs every line again, and a notice gives the number
+ of lines that were dropped. The default is 10000 lines a second.
+ 
+ @param linesPerSecond - NSUInteger, the limit. 0 turns throttling off.
  */
-+ (void)debugLog:(char *)sourceFile
-	  lineNumber:(int)lineNumber
-		  format:(NSString *)format, ...;
++ (void)setSiteRateLimit:(NSUInteger)linesPerSecond
 {
-    va_list ap;
-    NSString *print, *file;
-    if(__sDebugLoggingOn == NO)
-        return;
-    va_start(ap, format);
-    file = [NSString stringWithCString:sourceFile encoding:NSUTF8StringEncoding];
-    print = [[NSString alloc] initWithFormat:format arguments:ap];
-    va_end(ap);
-    
-    __sCurLogFunc(@"%s:%d %@", [[file lastPathComponent] UTF8String], lineNumber, print);
-    
-    [print release];
+	__sSiteRateLimit = linesPerSecond;
 }
 
 
 /*!
- Enhances NSLog, Called by the #ASDFnLog macro.
+ @brief Sets how many lines a throttled call site logs.
  
- Calling this method via the macro enhances NSLog() by adding the source file name,
- line number and the name of the calling method/function to the log output.
+ @param oneIn - NSUInteger, a throttled site logs 1 line in this many. The default is 100.
+ */
++ (void)setThrottledSampleRate:(NSUInteger)oneIn
+{
+	__sThrottledSampleRate = (oneIn == 0 ? 1 : oneIn);
+}
+
+
+/*!
+ @brief Sets the output latency above which ASLog sheds load.
  
- Logging is controlled via the the static BOOL __sDebugLoggingOn which is in turn
- controlled by the DEBUG_LOG_AUTO_ENABLE macro, the environment variable NSDebugEnabled
- or the control method +setlogOn: Logging is directed to whatever stream stderr is currently
- directed to.
+ ASLog keeps a moving average of the time taken to write a log line. While it is 
+ above this latency, because the disk or whatever stderr goes to is struggling, one 
+ more level is dropped each second: first debug lines, then normal lines. Warnings 
+ are never dropped. Once the average falls below half the latency the levels are 
+ restored, one a second. Each step is logged.
  
- @param sourceFile - c-string pointer holding the name of the source file.
+ The default is 0.05 seconds.
  
- @param lineNumber - int holding the line number in the source file of the call.
+ @param latency - NSTimeInterval, average seconds per line. 0 turns shedding off.
+ */
++ (void)setShedLatency:(NSTimeInterval)latency
+{
+	__sShedLatency = (uint64_t)(latency * 1000000.0);
+	if (__sShedLatency == 0)
+		__sShedLevel = 0;
+}
+
+
+/*!
+ @brief Switches between synchronous and asynchronous output.
  
- @param functionName - c-string pointer holding the name of the calling method/function.
+ In asynchronous mode the logging methods format the line on the calling thread and 
+ queue it, a background writer thread writes it to stderr. The line is written as it
+ stands, as QuietLog() would, NSLog() is not used. 
  
- @param format - NSString * that holds the formatting string for NSLog().
+ Warnings and the other levels are queued in separate lanes. The writer always 
+ empties the warning lane first and the warning lane has space of its own, so a 
+ flood of debug lines can neither delay warnings for long nor push them out: a 
+ warning waits for space rather than being dropped. Debug and normal lines are 
+ dropped, and counted, if their lane is full.
  
- @param ...	- variadic argument list.
+ Lines still queued when the program exits are written out. Turning asynchronous 
+ output off writes out anything queued before returning.
+ 
+ @param asyncOn - BOOL, if YES then output is asynchronous
  */
-+ (void)debugLog:(char *)sourceFile
-	  lineNumber:(int)lineNumber
-		function:(char *)functionName
-		  format:(NSString *)format, ...;
++ (void)setAsyncOn:(BOOL)asyncOn
 {
-    va_list ap;
-    NSString *print, *file, *function;
-    if(__sDebugLoggingOn == NO)
-        return;
-    va_start(ap,format);
-    file = [NSString stringWithCString:sourceFile encoding:NSUTF8StringEncoding];
-    function = [NSString stringWithCString:functionName encoding:NSUTF8StringEncoding];
-    print = [[NSString alloc] initWithFormat:format arguments:ap];
-    va_end(ap);
-    
-    __sCurLogFunc(@"%s:%d in %@ %@", [[file lastPathComponent] UTF8String], lineNumber, function, print);
-    
-    [print release];
+	if (asyncOn) {
+		__sAsyncOn = ASLogAsyncStart();
+	} else {
+		__sAsyncOn = NO;
+		ASLogAsyncFlush();
+	}
 }
 
-#pragma mark Release logging methods
 
 /*!
- Basic NSLog, Called by the #ASNSLog macro.
+ @brief Sets how the asynchronous writer thread waits for work.
  
- Calling this method via the macro calls un-adorned  NSLog().
+ - ASLogWriterWakeupBlock (the default) sleeps until a line is queued.
+ - ASLogWriterWakeupSpin never sleeps, for the lowest latency at the cost of a CPU.
+ - ASLogWriterWakeupSpinThenBlock spins for interval after the queue empties, then sleeps.
+ - ASLogWriterWakeupInterval wakes every interval and writes whatever has been queued 
+   in one go. Only warnings wake it early. With an interval of 0 any line wakes it, as 
+   with ASLogWriterWakeupBlock.
  
- Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
- directed to.
+ In every mode a producer only makes a system call to wake the writer when the writer 
+ is actually asleep (on Linux a futex wake), so a busy writer costs producers nothing.
  
- @param format - NSString * that holds the formatting string for NSLog().
+ @param wakeup - ASLogWriterWakeup, the strategy.
  
- @param ...	- variadic argument list.
+ @param interval - NSTimeInterval, spin time or batch interval in seconds, ignored by
+ the other strategies.
  */
-+ (void)log:(NSString *)format, ...;
++ (void)setWriterWakeup:(ASLogWriterWakeup)wakeup interval:(NSTimeInterval)interval
 {
-    va_list ap;
-    NSString *print;
-    va_start(ap, format);
-    print = [[NSString alloc] initWithFormat:format arguments:ap];
-    va_end(ap);
-    
-    __sCurLogFunc(@"%@", print);
-    
-    [print release];
+	__sWriterInterval = (uint64_t)(interval * 1000000.0);
+	__sWriterWakeup = wakeup;
+	ASLogWakeWriter(YES);
 }
 
 
 /*!
- Enhances NSLog, Called by the #ASFlLog macro.
- 
- Calling this method via the macro enhances NSLog() by adding the source file name
- and line number of the call to the log output.
- 
- Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
- directed to.
- 
- @param sourceFile - c-string pointer holding the name of the source file.
+ @brief Pins the asynchronous writer thread to a CPU.
  
- @param lineNumber - int holding the line number in the source file of the call.
+ Keeps log I/O on a housekeeping core, off the cores latency sensitive threads run on.
+ Linux only, ignored elsewhere.
  
- @param format - NSString * that holds the formatting string for NSLog().
+ @param cpu - int, the CPU number, or -1 to let the thread run on any CPU again.
  
- @param ...	- variadic argument list.
+ @return NO if cpu is out of range, the setting is left as it was.
  */
-+ (void)log:(char *)sourceFile
-	  lineNumber:(int)lineNumber
-		  format:(NSString *)format, ...;
++ (BOOL)setWriterCPU:(int)cpu
 {
-    va_list ap;
-    NSString *print, *file;
-    va_start(ap, format);
-    file = [NSString stringWithCString:sourceFile encoding:NSUTF8StringEncoding];
-    print = [[NSString alloc] initWithFormat:format arguments:ap];
-    va_end(ap);
-    
-    __sCurLogFunc(@"%s:%d %@", [[file lastPathComponent] UTF8String], lineNumber, print);
-    
-    [print release];
+#if defined(__linux__)
+	if (cpu < -1 || cpu >= CPU_SETSIZE)
+		return NO;
+#endif
+	__sWriterCPU = cpu;
+	__sWriterSettingsChanged = YES;
+	ASLogWakeWriter(YES);
+	return YES;
 }
 
 
 /*!
- Enhances NSLog, Called by the #ASFnLog macro.
- 
- Calling this method via the macro enhances NSLog() by adding the source file name,
- line number and the name of the calling method/function to the log output.
- 
- Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
- directed to.
+ @brief Sets the scheduling priority of the asynchronous writer thread.
  
- @param sourceFile - c-string pointer holding the name of the source file.
+ Linux only, ignored elsewhere.
  
- @param lineNumber - int holding the line number in the source file of the call.
+ @param niceValue - int, the thread's nice value, 0 by default.
  
- @param functionName - c-string pointer holding the name of the calling method/function.
+ @param idle - BOOL, YES to run the thread under SCHED_IDLE, so it only gets CPU time
+ nothing else wants.
+ */
++ (void)setWriterNice:(int)niceValue idle:(BOOL)idle
+{
+	__sWriterNice = niceValue;
+	__sWriterIdle = idle;
+	__sWriterSettingsChanged = YES;
+	ASLogWakeWriter(YES);
+}
+
+
+/*!
+ @brief Sets the size of the asynchronous queue.
  
- @param format - NSString * that holds the formatting string for NSLog().
+ Only has an effect before asynchronous output is first turned on.
  
- @param ...	- variadic argument list.
+ @param size - NSUInteger, bytes of queue for debug and normal lines. Warnings get a 
+ sixteenth of this again, but at least 64KB. The default is 1MB.
  */
-+ (void)log:(char *)sourceFile
-	  lineNumber:(int)lineNumber
-		function:(char *)functionName
-		  format:(NSString *)format, ...;
++ (void)setAsyncQueueSize:(NSUInteger)size
 {
-    va_list ap;
-    NSString *print, *file, *function;
-    va_start(ap,format);
-    file = [NSString stringWithCString:sourceFile encoding:NSUTF8StringEncoding];
-    function = [NSString stringWithCString:functionName encoding:NSUTF8StringEncoding];
-    print = [[NSString alloc] initWithFormat:format arguments:ap];
-    va_end(ap);
-    
-    __sCurLogFunc(@"%s:%d in %@ %@", [[file lastPathComponent] UTF8String], lineNumber, function, print);
-    
-    [print release];
+	__sAsyncQueueSize = (size < 64 * 1024 ? 64 * 1024 : size);
 }
 
-#pragma mark Warning logging methods
 
 /*!
- A simple substitute for NSLog(), called by the #ASNSWarn macro.
+ @brief Gives each NUMA node its own queue for debug and normal lines.
  
- Calling this method via the macro enhances NSLog() by adding the tag "WARNING:" 
- to the log output.
- 
- The macro could simply call NSLog with the same paramters but then we would loose
- the "WARNING:" flag.
+ Each node's queue is placed in that node's memory and threads queue to the one for 
+ the node they run on, so producers on one socket do not write into the other's 
+ memory. Each queue is the size set by +setAsyncQueueSize:. The writer thread drains
+ them in turn. Only has an effect before asynchronous output is first turned on. 
+ Linux only, ignored elsewhere. The per-thread formatting buffers need nothing, they
+ are allocated and first touched by the thread that uses them.
  
- Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
- directed to.
+ @param numaOn - BOOL, YES for one queue per node. The default is NO.
+ */
++ (void)setAsyncNUMAOn:(BOOL)numaOn
+{
+	__sAsyncNUMAOn = numaOn;
+}
+
+
+/*!
+ @brief Backs the asynchronous queues with 2MB huge pages, to cut TLB misses.
  
- @param format - NSString * that holds the formatting string for NSLog().
+ Pages from the reserved huge page pool (MAP_HUGETLB) are used if there are any, 
+ otherwise transparent huge pages are asked for with madvise(). Queues of at least 
+ a huge page are rounded up to whole ones, smaller queues, such as the warning queue,
+ keep normal pages. Only has an effect before asynchronous output is 
+ first turned on. Linux only, ignored elsewhere.
  
- @param ...	- variadic argument list.
+ @param hugePagesOn - BOOL, YES to use huge pages. The default is NO.
  */
-+ (void)warn:(NSString *)format, ...;
++ (void)setAsyncHugePagesOn:(BOOL)hugePagesOn
 {
-    va_list ap;
-    NSString *print;
-    va_start(ap, format);
-    print = [[NSString alloc] initWithFormat:format arguments:ap];
-    va_end(ap);
-    
-    __sCurLogFunc(@"WARNING: %@", print);
-    
-    [print release];
+	__sAsyncHugePages = hugePagesOn;
 }
 
 
 /*!
- An enhanced substitute for NSLog(), called by the #ASWarn macro.
+ @brief Sets the memory budget for lines too big for the asynchronous queue.
  
- Calling this method via the macro enhances NSLog() by adding the tag "WARNING:" and the
- source file name and line number of the call to the log output.
+ A line longer than half its queue, a big hex dump say, is copied into a record taken
+ from a pool belonging to the logging thread and queued in its place. The writer 
+ thread hands records back to the pool they came from for reuse, so they are never 
+ freed on another thread.
  
- Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
- directed to.
+ @param budget - NSUInteger, most bytes all the pools together may hold. The default 
+ is 4MB, 0 turns the pools off.
+ */
++ (void)setAsyncPoolBudget:(NSUInteger)budget
+{
+	__sPoolBudget = budget;
+}
+
+
+/*!
+ @brief Sets what happens to a line too big for the asynchronous queue when the 
+ pools are out of budget.
  
- @param sourceFile - c-string pointer holding the name of the source file.
+ @param full - ASLogPoolFull. ASLogPoolFullWrite, the default, writes the line 
+ straight away on the calling thread. ASLogPoolFullDrop drops it and counts it with 
+ the other dropped lines. Warnings are always written.
+ */
++ (void)setAsyncPoolFull:(ASLogPoolFull)full
+{
+	__sPoolFull = full;
+}
+
+
+/*!
+ @brief Gathers each thread's debug and normal lines in a small buffer of its own 
+ before queueing them.
  
- @param lineNumber - int holding the line number in the source file of the call.
+ Only has an effect in asynchronous mode. A thread's lines are copied into the queue 
+ a chunk of up to ASLogStageSize bytes at a time: when the buffer is full, when its 
+ oldest line has waited the interval, or before a line that goes into the queue 
+ directly. The queue's lock is then taken, and the writer thread woken, once a chunk 
+ rather than once a line. The writer thread flushes the buffers of threads that 
+ have gone quiet, and +flush all of them. Warnings are never staged.
  
- @param format - NSString * that holds the formatting string for NSLog().
+ @param stagingOn - BOOL, YES to stage lines, NO, the default, to queue each at once.
  
- @param ...	- variadic argument list.
+ @param interval - NSUInteger, longest a line may wait to be queued, in microseconds.
+ The default is 1000.
  */
-+ (void)warn:(char *)sourceFile
-	  lineNumber:(int)lineNumber
-		  format:(NSString *)format, ...;
++ (void)setAsyncStagingOn:(BOOL)stagingOn interval:(NSUInteger)interval
 {
-    va_list ap;
-    NSString *print, *file;
-    va_start(ap, format);
-    file = [NSString stringWithCString:sourceFile encoding:NSUTF8StringEncoding];
-    print = [[NSString alloc] initWithFormat:format arguments:ap];
-    va_end(ap);
-    
-    __sCurLogFunc(@"WARNING: %s:%d %@", [[file lastPathComponent] UTF8String], lineNumber, print);
-    
-    [print release];
+	__sStageInterval = interval;
+	__sStagingOn = stagingOn;
 }
 
 
 /*!
- An enhanced substitute for NSLog(), called by the #ASWarn macro.
- 
- Calling this method via the macro enhances NSLog() by adding the tag "WARNING:" and the
- source file name, line number and calling method/function name to the log output.
+ @brief Leaves the -description of immutable %@ arguments to the writer thread.
  
- Logging cannot be disabled. Logging is directed to whatever stream stderr is currently
- directed to.
+ Only has an effect in asynchronous mode. Dates and instances of classes added with 
+ +deferDescriptionsForClass: are retained into the queued line rather than formatted
+ on the calling thread; strings and numbers are appended straight away, which costs 
+ no more than leaving them. The writer
+ thread formats them, in an autorelease pool of its own, and releases them. Such a 
+ line is queued in a record from the thread's pool, see +setAsyncPoolBudget:, and 
+ formatted on the calling thread after all if the pools are out of budget.
  
- @param sourceFile - c-string pointer holding the name of the source file.
+ @param deferOn - BOOL, YES to leave them, NO, the default, to format them straight away.
+ */
++ (void)setAsyncDeferDescriptionsOn:(BOOL)deferOn
+{
+	__sDeferDescriptionsOn = deferOn;
+}
+
+
+/*!
+ @brief Lets the -description of a class's instances, and its subclasses', be left to
+ the writer thread, see +setAsyncDeferDescriptionsOn:.
  
- @param lineNumber - int holding the line number in the source file of the call.
+ Only for classes whose instances never change once made, and whose -description 
+ is safe to call on another thread.
  
- @param functionName - c-string pointer holding the name of the calling method/function.
+ @param aClass - the class.
  
- @param format - NSString * that holds the formatting string for NSLog().
+ @return YES if added, NO if ASLogMaxDeferredClasses are already added.
+ */
++ (BOOL)deferDescriptionsForClass:(Class)aClass
+{
+	int i;
+	
+	pthread_mutex_lock(&__sDeferredClassLock);
+	for (i = 0; i < __sDeferredClassCount; i++)
+		if (__sDeferredClasses[i] == aClass)
+			break;
+	if (i == __sDeferredClassCount && i < ASLogMaxDeferredClasses) {
+		__sDeferredClasses[i] = aClass;
+		__sync_synchronize();
+		__sDeferredClassCount = i + 1;
+	}
+	pthread_mutex_unlock(&__sDeferredClassLock);
+	return (i < ASLogMaxDeferredClasses);
+}
+
+
+/*!
+ @brief Waits until everything logged so far has been written.
  
- @param ...	- variadic argument list.
+ Only has anything to do in asynchronous mode.
  */
-+ (void)warn:(char *)sourceFile
-	  lineNumber:(int)lineNumber
-		function:(char *)functionName
-		  format:(NSString *)format, ...;
++ (void)flush
 {
-    va_list ap;
-    NSString *print, *file, *function;
-    va_start(ap,format);
-    file = [NSString stringWithCString:sourceFile encoding:NSUTF8StringEncoding];
-    function = [NSString stringWithCString:functionName encoding:NSUTF8StringEncoding];
-    print = [[NSString alloc] initWithFormat:format arguments:ap];
-    va_end(ap);
-    
-    __sCurLogFunc(@"WARNING: %s:%d in %@ %@", [[file lastPathComponent] UTF8String], lineNumber, function, print);
-    
-    [print release];
+	ASLogAsyncFlush();
 }
 
-#pragma mark Control methods
 
 /*!
- Programmatic control of logging for the debug logging methods.
+ @brief Sets the maximum length of a formatted log message.
  
- Even if logging is not enabled via the DEBUG_LOG_AUTO_ENABLE macro or the environment
- variable NSDebugEnabled you can enable/disable it at runtime with this call.
+ Formatting stops once a message reaches this many bytes and " ...[truncated]" is 
+ appended, so that one call logging a huge object costs no more than this. Arrays, 
+ sets and dictionaries logged with %@ are only walked as far as needed. The default
+ is 16384, the smallest length accepted is 64.
  
- This has no effect on the "Normal" or "Warning" logging methods and will have no
- effect if the debugging macros have been compiled out because the BUILD_WITH_DEBUG_LOGGING
- macro was not defined.
+ Each thread that logs keeps a buffer of this size.
  
- @param logOn - BOOL, if YES then logging is enabled
+ @param maxRecordLength - NSUInteger, maximum message length in bytes.
  */
-+ (void) setLogOn: (BOOL) logOn
++ (void)setMaxRecordLength:(NSUInteger)maxRecordLength
 {
-    __sDebugLoggingOn=logOn;
+	__sMaxRecordLength = (maxRecordLength < 64 ? 64 : maxRecordLength);
 }
 
 
 /*!
- @brief Programmatic control of use of QuietLog() or NSLog().
+ @brief Sets a limit on all the memory ASLog allocates.
  
- Switched the logging/warning methods between using NSLog() and QuietLog().
- The latter behaves exactly the same as NSLog() except:
+ Covers the per-thread format buffers, the asynchronous queues, the record pools, 
+ hex dumps being built and the cache of parsed formats. Once it is reached ASLog makes do with less rather than 
+ failing: format buffers fall back to 1KB so messages are truncated sooner, queues 
+ are made smaller so they drop more, big lines are written directly or dropped (see
+ +setAsyncPoolFull:) and hex dumps show fewer bytes. Memory already allocated is 
+ kept, so a budget is best set before logging starts. See +memoryReport.
  
-	it is not intercepted and sent to /var/log/system.log
-	
-	it does not prepend the log line with all that date/time/process mess.
+ @param budget - NSUInteger, bytes ASLog may allocate. The default is 0, no limit.
+ */
++ (void)setMemoryBudget:(NSUInteger)budget
+{
+	__sMemoryBudget = budget;
+}
+
+
+/*!
+ @brief Reports the memory ASLog is holding, by component.
  
- @param quietOn - BOOL, if YES then logging functions will call QuietLog()
+ @return NSString * with one line per component, then the total against the budget 
+ and the number of allocations the budget has refused.
  */
-+ (void) setQuietOn: (BOOL) quietOn
++ (NSString *)memoryReport
 {
-	if (quietOn) {
-		__sCurLogFunc = QuietLog;
-	} else {
-		__sCurLogFunc = NSLog;
-	}
+	NSMutableString *report = [NSMutableString stringWithString:@"ASLog memory:\n"];
+	int component;
+	
+	for (component = 0; component < ASLogMemoryComponents; component++)
+		[report appendFormat:@"  %-20s %10lu bytes\n", __sMemoryComponentNames[component], 
+			(unsigned long)__sMemoryUsed[component]];
+	[report appendFormat:@"  %-20s %10lu bytes (fixed)\n", "throttle table", (unsigned long)sizeof(__sSites)];
+	if (__sMemoryBudget != 0)
+		[report appendFormat:@"  %-20s %10lu bytes of %lu, %lu allocations refused", "total", 
+			(unsigned long)__sMemoryTotal, (unsigned long)__sMemoryBudget, __sMemoryRefused];
+	else
+		[report appendFormat:@"  %-20s %10lu bytes, no budget", "total", (unsigned long)__sMemoryTotal];
+	return report;
 }
 
 
@@ -540,6 +7184,7 @@ void QuietLog (NSString *format, ...)
 + (void)switchLoggingToFile:(NSString *)filePath fromAppDir:(BOOL)useAppDirAsBase
 {
 	NSString *logPath;
+	int fd;
 	
 	// have we been passed a file or file path
 	if (nil != filePath) {
@@ -582,19 +7227,395 @@ void QuietLog (NSString *format, ...)
 		logPath = [logDirPath stringByAppendingPathComponent:logName];
 	}
 	
-	// we have a full path for out log, reopen stderr to use that file
-	freopen([logPath fileSystemRepresentation], "a", stderr);
+	// we have a full path for out log, point stderr at that file
+	fd = open([logPath fileSystemRepresentation], O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+	ASLogSetDestination(fd);
+	close(fd);
+}
+
+
+/*!
+ @brief Sends log output to a circular log file of fixed size.
+ 
+ The file is a small header followed by capacity bytes written round and round, the 
+ newest lines overwriting the oldest, so it never grows and never needs rotating. 
+ Read it in order with Tools/aslog-cat. A file left by an earlier run with the same 
+ capacity is carried on, otherwise the file is replaced.
+ 
+ Lines ASLog writes itself go to the file: QuietLog(), asynchronous output and the 
+ binary macros. Lines handed to NSLog() still go wherever NSLog() sends them, so 
+ switch quiet logging on with +setQuietOn: as well. Processes forked after the file 
+ is opened share it safely.
+ 
+ @param filePath - NSString * holding the full path of the file.
+ 
+ @param capacity - NSUInteger, bytes of log kept, at least 4096.
+ 
+ @return YES if the file is now in use.
+ */
++ (BOOL)switchLoggingToCircularFile:(NSString *)filePath capacity:(NSUInteger)capacity
+{
+	static BOOL forkHandlers = NO;
+	ASLogRingFileHeader header;
+	const char *path = [filePath fileSystemRepresentation];
+	char *oldPath, *copy;
+	int fd, old;
+	
+	ASLogAsyncFlush();
+	if ((copy = strdup(path)) == NULL)
+		return NO;
+	fd = ASLogRingFileOpen(path, (capacity < 4096 ? 4096 : capacity), &header);
+	if (fd < 0) {
+		free(copy);
+		return NO;
+	}
+	
+	pthread_mutex_lock(&__sRingFileLock);
+	old = __sRingFile;
+	oldPath = __sRingFilePath;
+	__sRingHeader = header;
+	__sRingFile = fd;
+	__sRingFilePath = copy;
+	__sRingFileShared = NO;
+	if (!forkHandlers) {
+		pthread_atfork(ASLogRingFileForkPrepare, ASLogRingFileForkParent, ASLogRingFileForkChild);
+		forkHandlers = YES;
+	}
+	pthread_mutex_unlock(&__sRingFileLock);
+	if (old >= 0)
+		close(old);
+	free(oldPath);
+	return YES;
+}
+
+
+/*!
+ @brief Stops using the circular log file, output goes back to stderr.
+ */
++ (void)closeCircularFile
+{
+	int old;
+	
+	ASLogAsyncFlush();
+	pthread_mutex_lock(&__sRingFileLock);
+	old = __sRingFile;
+	__sRingFile = -1;
+	pthread_mutex_unlock(&__sRingFileLock);
+	if (old >= 0)
+		close(old);
 }
 
 /*!
  Restore the original destination of redirected stderr.
  
- Uses the stored value for the original destination of stderr (saved in __sStdErrPath)
- to reset stderr output to that stream.
+ Uses the duplicate of the stderr descriptor saved on entry (in __sStdErrSaved) to 
+ reset stderr output to that stream, which works for pipes, sockets, ttys and deleted
+ files alike. Destinations pushed with +pushLogDestination: are discarded.
  */
 + (void)restoreStdErr
 {
-	freopen(__sStdErrPath, "a", stderr);
+	pthread_mutex_lock(&__sDestinationLock);
+	while (__sDestinationDepth > 0)
+		close(__sDestinationStack[--__sDestinationDepth]);
+	pthread_mutex_unlock(&__sDestinationLock);
+	if (__sStdErrSaved >= 0)
+		ASLogSetDestination(__sStdErrSaved);
+}
+
+
+/*!
+ @brief Sends log output to a file until the matching +popLogDestination.
+ 
+ Calls nest: each pop goes back to wherever output went before its push. See 
+ +pushLogDescriptor:
+ 
+ @param filePath - NSString * holding the full path of the file, which is appended to.
+ 
+ @return YES if output now goes to the file.
+ */
++ (BOOL)pushLogDestination:(NSString *)filePath
+{
+	int fd = open([filePath fileSystemRepresentation], O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	BOOL pushed;
+	
+	if (fd < 0)
+		return NO;
+	pushed = [self pushLogDescriptor:fd];
+	close(fd);
+	return pushed;
+}
+
+
+/*!
+ @brief Sends log output to an open descriptor until the matching +popLogDestination.
+ 
+ The descriptor can be anything writable: a file, pipe, socket or tty. It is 
+ duplicated onto stderr with dup2(), which switches every writer at once, with no path
+ lookup and no stdio reopening. The caller keeps, and may close, its own descriptor.
+ 
+ @param fd - int, the descriptor.
+ 
+ @return NO if the pushes nest too deeply or fd is not valid.
+ */
++ (BOOL)pushLogDescriptor:(int)fd
+{
+	int saved;
+	
+	pthread_mutex_lock(&__sDestinationLock);
+	if (__sDestinationDepth == ASLogDestinationDepth
+		|| (saved = fcntl(fileno(stderr), F_DUPFD_CLOEXEC, 0)) < 0) {
+		pthread_mutex_unlock(&__sDestinationLock);
+		return NO;
+	}
+	if (!ASLogSetDestination(fd)) {
+		close(saved);
+		pthread_mutex_unlock(&__sDestinationLock);
+		return NO;
+	}
+	__sDestinationStack[__sDestinationDepth++] = saved;
+	pthread_mutex_unlock(&__sDestinationLock);
+	return YES;
+}
+
+
+/*!
+ @brief Sends log output back to where it went before the last +pushLogDestination:
+ or +pushLogDescriptor:
+ 
+ @return NO if there was nothing to pop.
+ */
++ (BOOL)popLogDestination
+{
+	int saved;
+	
+	pthread_mutex_lock(&__sDestinationLock);
+	if (__sDestinationDepth == 0) {
+		pthread_mutex_unlock(&__sDestinationLock);
+		return NO;
+	}
+	saved = __sDestinationStack[--__sDestinationDepth];
+	ASLogSetDestination(saved);
+	close(saved);
+	pthread_mutex_unlock(&__sDestinationLock);
+	return YES;
+}
+
+
+/*!
+ @brief Also sends log output to an open descriptor, through a queue and writer 
+ thread of its own.
+ 
+ Each sink gets a copy of every write ASLog makes, as it is made, so the lines are 
+ formatted once however many sinks there are. A sink that cannot keep up, a full 
+ pipe or a stalled socket, drops lines once its queue is full, and notes how many 
+ in its own output when it catches up; neither the main destination nor the other 
+ sinks wait for it. The sink's thread waits for it at most ASLogSinkFlushTimeout and 
+ drops what it could not write by then.
+ 
+ The sink gets a descriptor of its own that does not block, the caller keeps fd as 
+ it was. Except on Linux a pipe or tty shares fd's open file description, and fd is 
+ left non-blocking too.
+ 
+ Lines handed to NSLog() are not copied, use the asynchronous mode, the fast header or
+ QuietLog so that ASLog writes them itself. The sink is written to with writev(), see
+ +addLogSink:queueSize:splicing: for a pipe that is fed a lot.
+ 
+ @param fd - int, the descriptor.
+ 
+ @param queueSize - NSUInteger, bytes the sink's queue holds, at least 4096.
+ 
+ @return NO if there are already ASLogMaxSinks sinks, fd is not valid, the memory 
+ budget will not allow the queue or the thread cannot be started.
+ */
++ (BOOL)addLogSink:(int)fd queueSize:(NSUInteger)queueSize
+{
+	return [self addLogSink:fd queueSize:queueSize splicing:NO];
+}
+
+
+/*!
+ @brief Also sends log output to an open descriptor, as +addLogSink:queueSize:, and 
+ on Linux optionally hands a pipe the queue's pages rather than copy them.
+ 
+ With splicing, runs of at least ASLogSinkSpliceMinimum queued bytes go to a pipe with
+ vmsplice(); shorter runs, and descriptors that are not pipes, are written as usual, 
+ which for them is faster. Spliced bytes' space in the queue is reused once the pipe 
+ has been drained, so the queue should be a few times ASLogSinkSpliceMinimum and is 
+ raised to 4 times it. If other writers keep the pipe from ever draining, after 
+ ASLogSinkFlushTimeout the queue is moved to fresh memory, the pipe keeps the old 
+ pages until they are read, and the sink is written to from then on. Pages a pipe 
+ holds are outside the memory budget, at most the pipe's capacity (64KB by default).
+ 
+ Splicing pays off for a sink that is fed tens of megabytes a second and read as 
+ fast: with the reader keeping up, handing over 64KB runs moved about twice the bytes
+ writev() did, while 4KB runs moved less. Measure before turning it on.
+ 
+ @param fd - int, the descriptor.
+ 
+ @param queueSize - NSUInteger, bytes the sink's queue holds, at least 4096.
+ 
+ @param splicing - BOOL, YES to splice into fd if it is a pipe.
+ 
+ @return NO if there are already ASLogMaxSinks sinks, fd is not valid, the memory 
+ budget will not allow the queue or the thread cannot be started.
+ */
++ (BOOL)addLogSink:(int)fd queueSize:(NSUInteger)queueSize splicing:(BOOL)splicing
+{
+	static BOOL forkHandlers = NO;
+	ASLogSink *sink = NULL;
+#if defined(__linux__)
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	struct stat status;
+#endif
+	int s;
+	
+	if (queueSize < 4096)
+		queueSize = 4096;
+#if defined(__linux__)
+	if (splicing && queueSize < 4 * ASLogSinkSpliceMinimum)
+		queueSize = 4 * ASLogSinkSpliceMinimum;
+	// whole pages, for mmap()
+	queueSize = (queueSize + page - 1) / page * page;
+#endif
+	pthread_rwlock_wrlock(&__sSinkLock);
+	for (s = 0; s < ASLogMaxSinks && sink == NULL; s++)
+		if (!__sSinks[s].used)
+			sink = &__sSinks[s];
+	if (sink == NULL || !ASLogMemoryReserve(ASLogMemoryQueues, queueSize)) {
+		pthread_rwlock_unlock(&__sSinkLock);
+		return NO;
+	}
+	// the slot's lock and conditions are kept from one sink to the next
+	if (!sink->initialized) {
+		pthread_mutex_init(&sink->lock, NULL);
+		pthread_cond_init(&sink->ready, NULL);
+		pthread_cond_init(&sink->drained, NULL);
+		sink->initialized = YES;
+	}
+	sink->head = sink->sent = sink->tail = sink->piped = 0;
+	sink->stalled = 0;
+	sink->dropped = sink->droppedTotal = 0;
+	sink->closing = sink->finished = sink->abandoned = NO;
+	sink->splicing = sink->midLine = NO;
+	if ((sink->fd = ASLogSinkOpen(fd, &sink->socket)) < 0
+		|| (sink->bytes = ASLogSinkAllocate(queueSize)) == NULL) {
+		if (sink->fd >= 0)
+			close(sink->fd);
+		ASLogMemoryRelease(ASLogMemoryQueues, queueSize);
+		pthread_rwlock_unlock(&__sSinkLock);
+		return NO;
+	}
+	sink->size = queueSize;
+#if defined(__linux__)
+	sink->splicing = (splicing && fstat(sink->fd, &status) == 0 && S_ISFIFO(status.st_mode));
+#endif
+	if (pthread_create(&sink->thread, NULL, ASLogSinkMain, sink) != 0) {
+		ASLogSinkDeallocate(sink->bytes, sink->size);
+		close(sink->fd);
+		ASLogMemoryRelease(ASLogMemoryQueues, queueSize);
+		pthread_rwlock_unlock(&__sSinkLock);
+		return NO;
+	}
+	sink->used = YES;
+	pthread_mutex_lock(&sink->lock);
+	sink->active = YES;
+	pthread_mutex_unlock(&sink->lock);
+	__atomic_or_fetch(&__sSinkMask, 1u << (sink - __sSinks), __ATOMIC_RELEASE);
+	if (!forkHandlers) {
+		pthread_atfork(ASLogSinkForkPrepare, ASLogSinkForkParent, ASLogSinkForkChild);
+		atexit(ASLogSinksFlush);
+		forkHandlers = YES;
+	}
+	pthread_rwlock_unlock(&__sSinkLock);
+	return YES;
+}
+
+
+/*!
+ @brief Stops sending log output to a sink added with +addLogSink:queueSize:
+ 
+ What the sink has queued is written first, the call waits up to 
+ ASLogSinkFlushTimeout for that. A sink that takes longer, because nothing reads it,
+ is left to its thread, which frees it once it is done; until then its slot counts 
+ towards ASLogMaxSinks.
+ 
+ @param fd - int, the descriptor passed to +addLogSink:queueSize:, which stays open.
+ */
++ (void)removeLogSink:(int)fd
+{
+	ASLogSink *sink = NULL;
+	struct stat given, held;
+	struct timespec until;
+	pthread_t thread;
+	BOOL finished;
+	int s;
+	
+	ASLogAsyncFlush();
+	if (fstat(fd, &given) != 0)
+		return;
+	pthread_rwlock_wrlock(&__sSinkLock);
+	for (s = 0; s < ASLogMaxSinks && sink == NULL; s++)
+		if (__sSinks[s].active && fstat(__sSinks[s].fd, &held) == 0
+			&& held.st_dev == given.st_dev && held.st_ino == given.st_ino)
+			sink = &__sSinks[s];
+	if (sink == NULL) {
+		pthread_rwlock_unlock(&__sSinkLock);
+		return;
+	}
+	__atomic_and_fetch(&__sSinkMask, ~(1u << (sink - __sSinks)), __ATOMIC_RELEASE);
+	pthread_mutex_lock(&sink->lock);
+	sink->active = NO;
+	pthread_rwlock_unlock(&__sSinkLock);
+	sink->closing = YES;
+	pthread_cond_signal(&sink->ready);
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += ASLogSinkFlushTimeout;
+	while (!sink->finished)
+		if (pthread_cond_timedwait(&sink->drained, &sink->lock, &until) == ETIMEDOUT)
+			break;
+	finished = sink->finished;
+	sink->abandoned = !finished;
+	// once abandoned the thread may free the slot and a new sink take it
+	thread = sink->thread;
+	pthread_mutex_unlock(&sink->lock);
+	if (!finished) {
+		pthread_detach(thread);
+		return;
+	}
+	pthread_join(thread, NULL);
+	ASLogSinkRelease(sink);
+}
+
+
+/*!
+ @brief Lines a sink has dropped because its queue was full or it could not be 
+ written to.
+ 
+ @param fd - int, the descriptor passed to +addLogSink:queueSize:
+ 
+ @return The count since the sink was added, 0 if fd is not a sink.
+ */
++ (NSUInteger)droppedLinesForLogSink:(int)fd
+{
+	NSUInteger dropped = 0;
+	struct stat given, held;
+	int s;
+	
+	if (fstat(fd, &given) != 0)
+		return 0;
+	pthread_rwlock_rdlock(&__sSinkLock);
+	for (s = 0; s < ASLogMaxSinks; s++)
+		if (__sSinks[s].active && fstat(__sSinks[s].fd, &held) == 0
+			&& held.st_dev == given.st_dev && held.st_ino == given.st_ino) {
+			pthread_mutex_lock(&__sSinks[s].lock);
+			dropped = __sSinks[s].droppedTotal;
+			pthread_mutex_unlock(&__sSinks[s].lock);
+			break;
+		}
+	pthread_rwlock_unlock(&__sSinkLock);
+	return dropped;
 }
 
 
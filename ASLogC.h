@@ -0,0 +1,211 @@
+/*!
+ ASLogC.h
+
+ \file ASLogC.h
+
+ \brief Interface to ASLog for plain C modules
+
+ \date 2026-10-18
+
+ ASLog.h can only be imported by Objective-C. This header can be included by C11 code
+ as well, and is imported by ASLog.h. Its macros work out the type of each argument
+ when they are compiled, using _Generic, and pass the arguments as an array of
+ ASLogCValue alongside a per call site ASLogCSite. No va_list is built and, after the
+ first call, the format is not parsed again. In asynchronous mode the arguments are
+ copied into the queue and the message is formatted by the writer thread.
+
+ The format must be a string literal. Up to ASLogCMaxArguments arguments are taken:
+ integers, floating point numbers, c-strings and pointers. A conversion is filled in
+ from the argument in its place whatever that argument's type: an integer for %f is
+ converted, a number for %s is logged as a pointer. Objects (%@) are not supported,
+ nor are positional (%n$) arguments, which are logged as they stand.
+
+ License
+ =======
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+	USA
+
+ */
+
+#ifndef ASLOGC_H
+#define ASLOGC_H
+
+#include <stddef.h>
+
+/*! \def ASLogCMaxArguments
+ @brief Most arguments the C logging macros take after the format
+ */
+#define ASLogCMaxArguments 8
+
+/*! \enum ASLogLevel
+ @brief Level of a log line, for the macros and methods that take the level as a parameter
+ */
+typedef enum {
+	ASLogLevelDebug = 0,	//!< Debug logging, only fires when debug logging is enabled
+	ASLogLevelNormal,		//!< Normal logging, always fires
+	ASLogLevelWarning		//!< Warning logging, always fires and adds "WARNING"
+} ASLogLevel;
+
+/*! \union ASLogCValue
+ @brief An argument of the C logging macros, which member is set is given by the
+ call site's signature
+ */
+typedef union {
+	long long i;				//!< 'i', signed integers
+	unsigned long long u;		//!< 'u', unsigned integers and _Bool
+	double d;					//!< 'd', floating point numbers
+	const char *s;				//!< 's', c-strings
+	const void *p;				//!< 'p', any other pointer
+} ASLogCValue;
+
+/*! \struct ASLogCSite
+ @brief A call site of the C logging macros, made once when the program is compiled
+ */
+typedef struct {
+	const char *format;			//!< the format, a string literal
+	const char *signature;		//!< one of "iudsp" per argument
+	int count;					//!< number of arguments
+} ASLogCSite;
+
+/*! \fn ASLogCWrite (ASLogLevel level, const char *sourceFile, int lineNumber, const char *functionName, const ASLogCSite *site, const ASLogCValue *values)
+ @brief Logs a line from the C logging macros, use them rather than calling it
+ */
+extern void ASLogCWrite (ASLogLevel level, const char *sourceFile, int lineNumber, const char *functionName,
+						 const ASLogCSite *site, const ASLogCValue *values);
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+
+static inline ASLogCValue ASLogCSigned(long long value) { ASLogCValue v; v.i = value; return v; }
+static inline ASLogCValue ASLogCUnsigned(unsigned long long value) { ASLogCValue v; v.u = value; return v; }
+static inline ASLogCValue ASLogCDouble(double value) { ASLogCValue v; v.d = value; return v; }
+static inline ASLogCValue ASLogCString(const char *value) { ASLogCValue v; v.s = value; return v; }
+static inline ASLogCValue ASLogCPointer(const void *value) { ASLogCValue v; v.p = value; return v; }
+
+/*! \def ASLOGC_TYPE
+ @brief Signature character of an argument, decided when the program is compiled
+ */
+#define ASLOGC_TYPE(x) _Generic((x), \
+	_Bool: 'u', char: 'i', signed char: 'i', unsigned char: 'u', \
+	short: 'i', unsigned short: 'u', int: 'i', unsigned int: 'u', \
+	long: 'i', unsigned long: 'u', long long: 'i', unsigned long long: 'u', \
+	float: 'd', double: 'd', long double: 'd', \
+	char *: 's', const char *: 's', signed char *: 's', const signed char *: 's', \
+	unsigned char *: 's', const unsigned char *: 's', \
+	default: 'p')
+
+/*! \def ASLOGC_VALUE
+ @brief An argument as an ASLogCValue, the member set to match ASLOGC_TYPE
+ */
+#define ASLOGC_VALUE(x) _Generic((x), \
+	_Bool: ASLogCUnsigned, char: ASLogCSigned, signed char: ASLogCSigned, unsigned char: ASLogCUnsigned, \
+	short: ASLogCSigned, unsigned short: ASLogCUnsigned, int: ASLogCSigned, unsigned int: ASLogCUnsigned, \
+	long: ASLogCSigned, unsigned long: ASLogCUnsigned, long long: ASLogCSigned, unsigned long long: ASLogCUnsigned, \
+	float: ASLogCDouble, double: ASLogCDouble, long double: ASLogCDouble, \
+	char *: ASLogCString, const char *: ASLogCString, signed char *: ASLogCString, const signed char *: ASLogCString, \
+	unsigned char *: ASLogCString, const unsigned char *: ASLogCString, \
+	default: ASLogCPointer)(x)
+
+// the format is always the first argument, so none of these has an empty __VA_ARGS__
+#define ASLOGC_CAT(a, b) ASLOGC_CAT_(a, b)
+#define ASLOGC_CAT_(a, b) a##b
+#define ASLOGC_FORMAT(...) ASLOGC_FORMAT_(__VA_ARGS__, 0)
+#define ASLOGC_FORMAT_(f, ...) f
+#define ASLOGC_COUNT(...) ASLOGC_COUNT_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, 0)
+#define ASLOGC_COUNT_(f, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+
+#define ASLOGC_TYPES_0(f)
+#define ASLOGC_TYPES_1(f, a) ASLOGC_TYPE(a),
+#define ASLOGC_TYPES_2(f, a, ...) ASLOGC_TYPE(a), ASLOGC_TYPES_1(f, __VA_ARGS__)
+#define ASLOGC_TYPES_3(f, a, ...) ASLOGC_TYPE(a), ASLOGC_TYPES_2(f, __VA_ARGS__)
+#define ASLOGC_TYPES_4(f, a, ...) ASLOGC_TYPE(a), ASLOGC_TYPES_3(f, __VA_ARGS__)
+#define ASLOGC_TYPES_5(f, a, ...) ASLOGC_TYPE(a), ASLOGC_TYPES_4(f, __VA_ARGS__)
+#define ASLOGC_TYPES_6(f, a, ...) ASLOGC_TYPE(a), ASLOGC_TYPES_5(f, __VA_ARGS__)
+#define ASLOGC_TYPES_7(f, a, ...) ASLOGC_TYPE(a), ASLOGC_TYPES_6(f, __VA_ARGS__)
+#define ASLOGC_TYPES_8(f, a, ...) ASLOGC_TYPE(a), ASLOGC_TYPES_7(f, __VA_ARGS__)
+
+#define ASLOGC_VALUES_0(f) NULL
+#define ASLOGC_VALUES_1(f, a) (const ASLogCValue[]){ ASLOGC_VALUE(a) }
+#define ASLOGC_VALUES_2(f, a, b) (const ASLogCValue[]){ ASLOGC_VALUE(a), ASLOGC_VALUE(b) }
+#define ASLOGC_VALUES_3(f, a, b, c) (const ASLogCValue[]){ ASLOGC_VALUE(a), ASLOGC_VALUE(b), ASLOGC_VALUE(c) }
+#define ASLOGC_VALUES_4(f, a, b, c, d) (const ASLogCValue[]){ ASLOGC_VALUE(a), ASLOGC_VALUE(b), ASLOGC_VALUE(c), \
+	ASLOGC_VALUE(d) }
+#define ASLOGC_VALUES_5(f, a, b, c, d, e) (const ASLogCValue[]){ ASLOGC_VALUE(a), ASLOGC_VALUE(b), ASLOGC_VALUE(c), \
+	ASLOGC_VALUE(d), ASLOGC_VALUE(e) }
+#define ASLOGC_VALUES_6(f, a, b, c, d, e, g) (const ASLogCValue[]){ ASLOGC_VALUE(a), ASLOGC_VALUE(b), ASLOGC_VALUE(c), \
+	ASLOGC_VALUE(d), ASLOGC_VALUE(e), ASLOGC_VALUE(g) }
+#define ASLOGC_VALUES_7(f, a, b, c, d, e, g, h) (const ASLogCValue[]){ ASLOGC_VALUE(a), ASLOGC_VALUE(b), ASLOGC_VALUE(c), \
+	ASLOGC_VALUE(d), ASLOGC_VALUE(e), ASLOGC_VALUE(g), ASLOGC_VALUE(h) }
+#define ASLOGC_VALUES_8(f, a, b, c, d, e, g, h, k) (const ASLogCValue[]){ ASLOGC_VALUE(a), ASLOGC_VALUE(b), ASLOGC_VALUE(c), \
+	ASLOGC_VALUE(d), ASLOGC_VALUE(e), ASLOGC_VALUE(g), ASLOGC_VALUE(h), ASLOGC_VALUE(k) }
+
+/*! \def ASLOGC_LOG
+ @brief Logs a line from C, the common body of the C logging macros
+ */
+#define ASLOGC_LOG(level, function, ...) do { \
+	static const char _aslogSignature[] = { ASLOGC_CAT(ASLOGC_TYPES_, ASLOGC_COUNT(__VA_ARGS__))(__VA_ARGS__) 0 }; \
+	static const ASLogCSite _aslogSite = { "" ASLOGC_FORMAT(__VA_ARGS__) "", _aslogSignature, ASLOGC_COUNT(__VA_ARGS__) }; \
+	ASLogCWrite((level), __FILE__, __LINE__, (function), &_aslogSite, \
+				ASLOGC_CAT(ASLOGC_VALUES_, ASLOGC_COUNT(__VA_ARGS__))(__VA_ARGS__)); \
+} while (0)
+
+/*!
+ \name C Logging macros.
+
+ The C counterparts of the ASLog.h macros, taking a string literal format and up to
+ ASLogCMaxArguments arguments. The debug macros are compiled out unless
+ BUILD_WITH_DEBUG_LOGGING is defined.
+ */
+//@{
+
+/*! \def ASCDLog
+ @brief Debug logging from C + logs the sourcefile and line number
+
+ \def ASCDFnLog
+ @brief Debug logging from C + logs the sourcefile and line number and calling function
+ */
+#ifdef BUILD_WITH_DEBUG_LOGGING
+	#define ASCDLog(...) ASLOGC_LOG(ASLogLevelDebug, NULL, __VA_ARGS__)
+	#define ASCDFnLog(...) ASLOGC_LOG(ASLogLevelDebug, __func__, __VA_ARGS__)
+#else
+	#define ASCDLog(...) do { (void)sizeof(ASLOGC_FORMAT(__VA_ARGS__)); } while (0)
+	#define ASCDFnLog(...) do { (void)sizeof(ASLOGC_FORMAT(__VA_ARGS__)); } while (0)
+#endif
+
+/*! \def ASCFlLog
+ @brief Logging from C + logs the sourcefile and line number
+ */
+#define ASCFlLog(...) ASLOGC_LOG(ASLogLevelNormal, NULL, __VA_ARGS__)
+
+/*! \def ASCFnLog
+ @brief Logging from C + logs the sourcefile and line number and calling function
+ */
+#define ASCFnLog(...) ASLOGC_LOG(ASLogLevelNormal, __func__, __VA_ARGS__)
+
+/*! \def ASCWarn
+ @brief Logging from C + "WARNING" + logs the sourcefile and line number
+ */
+#define ASCWarn(...) ASLOGC_LOG(ASLogLevelWarning, NULL, __VA_ARGS__)
+
+/*! \def ASCFnWarn
+ @brief Logging from C + "WARNING" + logs the sourcefile and line number and calling function
+ */
+#define ASCFnWarn(...) ASLOGC_LOG(ASLogLevelWarning, __func__, __VA_ARGS__)
+
+//@} (C Logging macros)
+
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ ASLogRingFileForkTest.m
+
+ Checks that a parent and a child forked after +switchLoggingToCircularFile:capacity:
+ can both append to the circular log file without overwriting each other's lines.
+
+ Each process writes its own numbered lines with QuietLog(). Once the child has
+ exited the file is read back: every line of both processes must be there, whole and
+ in order. Exits 0 on success.
+
+ Build and run, on Linux with GNUstep:
+
+	cc -o ringfork Tests/ASLogRingFileForkTest.m ASLog.m -I. \
+		`gnustep-config --objc-flags` `gnustep-config --base-libs` && ./ringfork
+
+ or on macOS:
+
+	cc -o ringfork Tests/ASLogRingFileForkTest.m ASLog.m -I. -framework Foundation && ./ringfork
+ */
+
+#import <Foundation/Foundation.h>
+#import "ASLog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* --- Settings --- */
+
+#define LinesPerProcess 20000
+#define Capacity (8 << 20)
+#define HeaderSize 4096
+
+/*! The start of the file's header, see ASLogRingFileHeader in ASLog.m.
+ */
+typedef struct {
+	char magic[8];
+	uint64_t version;
+	uint64_t capacity;
+	uint64_t head;
+	uint64_t tail;
+} RingHeader;
+
+/* --- Checking --- */
+
+/*!
+ @brief Reads the file back and checks each process's lines.
+
+ @return 0 if every line is there, whole and in order.
+ */
+static int CheckFile(const char *path)
+{
+	RingHeader header;
+	char *data, *line, *end, expect[128];
+	int fd, last[2] = { -1, -1 }, got[2] = { 0, 0 }, bad = 0, number, which;
+	char tag;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+		fprintf(stderr, "cannot read %s\n", path);
+		return 1;
+	}
+	if (header.head > header.capacity) {
+		fprintf(stderr, "file wrapped, raise Capacity\n");
+		return 1;
+	}
+	data = malloc(header.head + 1);
+	if (data == NULL || pread(fd, data, header.head, HeaderSize) != (ssize_t)header.head) {
+		fprintf(stderr, "cannot read the data area\n");
+		return 1;
+	}
+	data[header.head] = '\0';
+	close(fd);
+
+	for (line = data; *line != '\0'; line = end + 1) {
+		end = strchr(line, '\n');
+		if (end == NULL) {
+			bad++;
+			break;
+		}
+		*end = '\0';
+		if (sscanf(line, "%c %d", &tag, &number) != 2 || (tag != 'p' && tag != 'c')
+			|| end - line != snprintf(expect, sizeof(expect), "%c %d ring fork test line", tag, number)) {
+			bad++;
+			continue;
+		}
+		which = (tag == 'c');
+		if (number != last[which] + 1)
+			bad++;
+		last[which] = number;
+		got[which]++;
+	}
+	free(data);
+	printf("parent %d, child %d lines, %d bad\n", got[0], got[1], bad);
+	return (bad != 0 || got[0] != LinesPerProcess || got[1] != LinesPerProcess);
+}
+
+/* --- Main --- */
+
+int main(int argc, char **argv)
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	char path[] = "/tmp/aslog-ringfork-XXXXXX";
+	pid_t child;
+	char tag;
+	int fd, i, status, result;
+
+	(void)argc;
+	(void)argv;
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	close(fd);
+	if (![ASLog switchLoggingToCircularFile:[NSString stringWithUTF8String:path] capacity:Capacity]) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+
+	child = fork();
+	if (child < 0)
+		return 1;
+	tag = (child == 0 ? 'c' : 'p');
+	for (i = 0; i < LinesPerProcess; i++)
+		QuietLog(@"%c %d ring fork test line", tag, i);
+	[ASLog flush];
+	if (child == 0)
+		_exit(0);
+
+	waitpid(child, &status, 0);
+	[ASLog closeCircularFile];
+	result = CheckFile(path);
+	unlink(path);
+	[pool release];
+	return result;
+}
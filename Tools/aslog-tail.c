@@ -0,0 +1,507 @@
+/*
+ *  aslog-tail.c
+ *
+ *	Follows an ASLog log file as it grows, like tail -f, across rotations, showing only
+ *	the lines that pass its filters and highlighting warnings.
+ *
+ *	The file is watched with inotify, so a log that is moved aside and replaced, or
+ *	deleted and recreated, is picked up again from the start of the new file, after
+ *	what was left in the old one. A file truncated in place is read again from the
+ *	start. Linux only.
+ *
+ *	Filters, all of which a line must pass:
+ *
+ *		-w				warnings only
+ *		-f file.m		lines logged from the source file file.m
+ *		-s file.m:42	lines logged from line 42 of file.m
+ *		-e regex		lines matching the POSIX extended regular expression
+ *
+ *	Debug and normal lines look the same in the log, so they cannot be told apart.
+ *
+ *	-w, -f and -s look for fields of the line prefix: "WARNING", written by %W or %L,
+ *	and "file.m:42", written by %f:%l as in the default layout. With a prefix pattern
+ *	(see +setPrefixPattern:) that leaves them out, or puts something between the file
+ *	and the line number, use -e instead.
+ *
+ *	To keep up with bursts of debug output the file is read in large chunks and each
+ *	chunk is first searched with memmem() for a piece of text every matching line must
+ *	contain: the warning tag, the source file or call site, or the longest run of plain
+ *	characters the regex requires. Only lines containing it are looked at further.
+ *
+ *	Other options:
+ *
+ *		-a				start from the beginning of the file rather than its end
+ *		-c				highlight warnings even when not writing to a terminal
+ *
+ *	Build with:	cc -O2 -o aslog-tail aslog-tail.c
+ *
+ *	Usage:		aslog-tail [-a] [-c] [-w] [-f file] [-s file:line] [-e regex] logfile
+ *
+ *	This library is free software; you can redistribute it and/or modify it under the
+ *	terms of the GNU Lesser General Public License as published by the Free Software
+ *	Foundation; either version 2.1 of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+/* --- Macro definitions --- */
+
+/*! \def ASLogTailChunk
+ @brief Bytes read from the log file at a time
+ */
+#define ASLogTailChunk (1024 * 1024)
+
+/*! \def ASLogTailWarningTag
+ @brief Text ASLog writes for warnings, in the %W tag "WARNING: " or as the %L level
+ */
+#define ASLogTailWarningTag "WARNING"
+
+/* --- Static globals --- */
+
+/*! YES to show warnings only (-w).
+ */
+static int __sWarningsOnly = 0;
+
+/*! Source file lines must come from (-f), with a ':' appended, or NULL.
+ */
+static char *__sSourceFile = NULL;
+
+/*! Call site lines must come from (-s), with a ' ' appended, or NULL.
+ */
+static char *__sCallSite = NULL;
+
+/*! Regular expression lines must match (-e), if __sHasRegex.
+ */
+static regex_t __sRegex;
+
+/*! YES if -e was given.
+ */
+static int __sHasRegex = 0;
+
+/*! Text every matching line contains, searched for first, or NULL to look at every line.
+ */
+static char *__sPrefilter = NULL;
+
+/*! Length of __sPrefilter.
+ */
+static size_t __sPrefilterLength = 0;
+
+/*! YES to highlight warnings.
+ */
+static int __sColor = 0;
+
+/*! Bytes read but not yet looked at, always starting at the beginning of a line.
+ */
+static char __sBuffer[2 * ASLogTailChunk];
+
+/*! Number of bytes in __sBuffer.
+ */
+static size_t __sBuffered = 0;
+
+/* --- Filtering --- */
+
+/*!
+ @brief Works out the longest run of plain characters a regex requires.
+
+ Conservative: bracket expressions, groups, escapes, '.' and anchors end a run, a
+ character followed by '?', '*' or '{' is left out as it may not be there, and a regex
+ with an alternation at the top level has no required text at all.
+
+ @param regex - the POSIX extended regular expression.
+
+ @param length - set to the length of the run.
+
+ @return a copy of the run, or NULL if there is none.
+ */
+static char *ASLogTailRegexLiteral(const char *regex, size_t *length)
+{
+	char *run = malloc(strlen(regex) + 1), *best = NULL;
+	size_t runLength = 0, bestLength = 0;
+	const char *p;
+	int depth = 0;
+
+	if (run == NULL)
+		return NULL;
+	for (p = regex; *p != '\0'; p++) {
+		if (*p == '|' && depth == 0) {
+			bestLength = 0;
+			break;
+		}
+		if (*p == '(' || *p == ')' || *p == '[' || *p == '\\' || *p == '.' || *p == '^'
+			|| *p == '$' || *p == '+' || *p == '?' || *p == '*' || *p == '{' || *p == '}' || depth > 0) {
+			// end of a run, keep it if it is the longest so far
+			if (runLength > bestLength) {
+				free(best);
+				best = strndup(run, runLength);
+				bestLength = (best == NULL ? 0 : runLength);
+			}
+			runLength = 0;
+			if (*p == '(')
+				depth++;
+			else if (*p == ')' && depth > 0)
+				depth--;
+			else if (*p == '\\' && p[1] != '\0')
+				p++;
+			else if (*p == '[') {
+				// skip the bracket expression, a ']' first in it is literal
+				p++;
+				if (*p == '^')
+					p++;
+				if (*p == ']')
+					p++;
+				while (*p != '\0' && *p != ']')
+					p++;
+				if (*p == '\0')
+					break;
+			}
+			continue;
+		}
+		if (p[1] == '?' || p[1] == '*' || p[1] == '{') {
+			// this character is optional, and ends the run before it
+			if (runLength > bestLength) {
+				free(best);
+				best = strndup(run, runLength);
+				bestLength = (best == NULL ? 0 : runLength);
+			}
+			runLength = 0;
+			continue;
+		}
+		run[runLength++] = *p;
+	}
+	if (*p == '\0' && runLength > bestLength) {
+		free(best);
+		best = strndup(run, runLength);
+		bestLength = (best == NULL ? 0 : runLength);
+	}
+	free(run);
+	if (bestLength == 0) {
+		free(best);
+		return NULL;
+	}
+	*length = bestLength;
+	return best;
+}
+
+
+/*!
+ @brief Tells whether a line contains a field, at its start or after a space.
+
+ @param line - the line.
+
+ @param length - length of the line.
+
+ @param field - the field, such as "file.m:".
+
+ @param needDigit - YES if the field must be followed by a digit.
+ */
+static int ASLogTailHasField(const char *line, size_t length, const char *field, int needDigit)
+{
+	size_t fieldLength = strlen(field);
+	const char *p = line, *end = line + length, *hit;
+
+	while ((hit = memmem(p, end - p, field, fieldLength)) != NULL) {
+		if ((hit == line || hit[-1] == ' ')
+			&& (!needDigit || (hit + fieldLength < end && hit[fieldLength] >= '0' && hit[fieldLength] <= '9')))
+			return 1;
+		p = hit + 1;
+	}
+	return 0;
+}
+
+
+/*!
+ @brief Tells whether a line passes every filter.
+
+ @param line - the line, without its line end.
+
+ @param length - length of the line.
+ */
+static int ASLogTailMatches(const char *line, size_t length)
+{
+	regmatch_t match;
+
+	if (__sWarningsOnly && memmem(line, length, ASLogTailWarningTag, sizeof(ASLogTailWarningTag) - 1) == NULL)
+		return 0;
+	if (__sSourceFile != NULL && !ASLogTailHasField(line, length, __sSourceFile, 1))
+		return 0;
+	if (__sCallSite != NULL && !ASLogTailHasField(line, length, __sCallSite, 0))
+		return 0;
+	if (__sHasRegex) {
+		match.rm_so = 0;
+		match.rm_eo = length;
+		if (regexec(&__sRegex, line, 1, &match, REG_STARTEND) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+
+/*!
+ @brief Writes out a matching line, highlighted if it is a warning.
+ */
+static void ASLogTailPrint(const char *line, size_t length)
+{
+	int warning = __sColor && memmem(line, length, ASLogTailWarningTag, sizeof(ASLogTailWarningTag) - 1) != NULL;
+
+	if (warning)
+		fputs("\033[1;31m", stdout);
+	fwrite(line, 1, length, stdout);
+	if (warning)
+		fputs("\033[0m", stdout);
+	putchar('\n');
+}
+
+
+/*!
+ @brief Filters whole lines.
+
+ With a prefilter only the lines around each place it is found are looked at, the
+ rest are skipped without being split into lines at all.
+
+ @param start - first byte, at the start of a line.
+
+ @param end - just past the last line end.
+ */
+static void ASLogTailFilter(const char *start, const char *end)
+{
+	const char *p = start, *hit, *lineStart, *lineEnd;
+
+	while (p < end) {
+		if (__sPrefilter != NULL) {
+			hit = memmem(p, end - p, __sPrefilter, __sPrefilterLength);
+			if (hit == NULL)
+				break;
+			lineStart = memrchr(p, '\n', hit - p);
+			lineStart = (lineStart == NULL ? p : lineStart + 1);
+		} else {
+			hit = lineStart = p;
+		}
+		lineEnd = memchr(hit, '\n', end - hit);
+		if (lineEnd == NULL)
+			lineEnd = end;
+		if (ASLogTailMatches(lineStart, lineEnd - lineStart))
+			ASLogTailPrint(lineStart, lineEnd - lineStart);
+		p = lineEnd + 1;
+	}
+}
+
+/* --- Following --- */
+
+/*!
+ @brief Reads whatever has been added to the file and filters it.
+
+ A partial last line is kept until the rest of it arrives, unless the buffer is full
+ of one line, which is then filtered as it stands.
+
+ @param fd - the log file.
+ */
+static void ASLogTailDrain(int fd)
+{
+	ssize_t got;
+	char *last;
+
+	for (;;) {
+		got = read(fd, __sBuffer + __sBuffered, sizeof(__sBuffer) - __sBuffered);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			break;
+		__sBuffered += got;
+		last = memrchr(__sBuffer, '\n', __sBuffered);
+		if (last == NULL && __sBuffered == sizeof(__sBuffer))
+			last = __sBuffer + __sBuffered - 1;
+		if (last == NULL)
+			continue;
+		ASLogTailFilter(__sBuffer, last + 1);
+		__sBuffered -= last + 1 - __sBuffer;
+		memmove(__sBuffer, last + 1, __sBuffered);
+	}
+	fflush(stdout);
+}
+
+
+/*!
+ @brief Opens the log file and watches it.
+
+ @return the descriptor, or -1 if the file is not there.
+ */
+static int ASLogTailOpen(const char *path, int watcher, int *watch)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd >= 0)
+		*watch = inotify_add_watch(watcher, path, IN_MODIFY | IN_ATTRIB);
+	return fd;
+}
+
+
+/*!
+ @brief Follows the log file for ever.
+
+ The directory is watched for a new file taking the log's name, the file itself for
+ data and for being deleted. A file moved aside is read on until its replacement
+ appears, as the program logging may still be writing to it. When it is replaced, 
+ what is left in the old file is read out before the new one is opened and read from
+ its start.
+ */
+static void ASLogTailFollow(const char *path, int fromStart)
+{
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char *copy = strdup(path), *name;
+	struct inotify_event *event;
+	struct pollfd waiting;
+	struct stat status;
+	off_t offset;
+	ssize_t got;
+	int watcher, fd, watch = -1, replaced;
+	char *p;
+
+	watcher = inotify_init1(IN_CLOEXEC);
+	if (watcher < 0 || copy == NULL) {
+		perror("aslog-tail: inotify");
+		exit(1);
+	}
+	name = strdup(basename(copy));
+	inotify_add_watch(watcher, dirname(copy), IN_CREATE | IN_MOVED_TO);
+
+	fd = ASLogTailOpen(path, watcher, &watch);
+	if (fd < 0 && errno != ENOENT) {
+		perror(path);
+		exit(1);
+	}
+	if (fd >= 0 && !fromStart)
+		lseek(fd, 0, SEEK_END);
+
+	for (;;) {
+		if (fd >= 0) {
+			ASLogTailDrain(fd);
+			// truncated in place, start again
+			offset = lseek(fd, 0, SEEK_CUR);
+			if (fstat(fd, &status) == 0 && status.st_size < offset) {
+				lseek(fd, 0, SEEK_SET);
+				__sBuffered = 0;
+				continue;
+			}
+		}
+
+		waiting.fd = watcher;
+		waiting.events = POLLIN;
+		if (poll(&waiting, 1, 1000) <= 0)
+			continue;
+		got = read(watcher, events, sizeof(events));
+		replaced = 0;
+		for (p = events; got > 0 && p < events + got; p += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *)p;
+			if (event->len > 0 && strcmp(event->name, name) == 0)
+				replaced = 1;
+			// deleted, but held open by us, so no IN_DELETE_SELF yet
+			else if (event->wd == watch && (event->mask & IN_ATTRIB) && fd >= 0
+					 && fstat(fd, &status) == 0 && status.st_nlink == 0)
+				replaced = 1;
+		}
+		if (!replaced)
+			continue;
+
+		// a new file has the name, or soon will: finish the old one and move over
+		if (fd >= 0) {
+			ASLogTailDrain(fd);
+			if (__sBuffered > 0) {
+				ASLogTailFilter(__sBuffer, __sBuffer + __sBuffered);
+				__sBuffered = 0;
+				fflush(stdout);
+			}
+			inotify_rm_watch(watcher, watch);
+			close(fd);
+		}
+		fd = ASLogTailOpen(path, watcher, &watch);
+	}
+}
+
+/* --- Main --- */
+
+static void ASLogTailUsage(void)
+{
+	fprintf(stderr, "usage: aslog-tail [-a] [-c] [-w] [-f file] [-s file:line] [-e regex] logfile\n"
+			"-w needs WARNING in the line prefix (%%W or %%L), -f and -s need file:line (%%f:%%l)\n");
+	exit(2);
+}
+
+
+int main(int argc, char *argv[])
+{
+	char message[256];
+	int option, fromStart = 0, error;
+	size_t length;
+	char *literal;
+
+	__sColor = isatty(fileno(stdout));
+	while ((option = getopt(argc, argv, "acwf:s:e:")) != -1) {
+		switch (option) {
+			case 'a':
+				fromStart = 1;
+				break;
+			case 'c':
+				__sColor = 1;
+				break;
+			case 'w':
+				__sWarningsOnly = 1;
+				break;
+			case 'f':
+				if (asprintf(&__sSourceFile, "%s:", optarg) < 0)
+					exit(1);
+				break;
+			case 's':
+				if (asprintf(&__sCallSite, "%s ", optarg) < 0)
+					exit(1);
+				break;
+			case 'e':
+				error = regcomp(&__sRegex, optarg, REG_EXTENDED | REG_NOSUB);
+				if (error != 0) {
+					regerror(error, &__sRegex, message, sizeof(message));
+					fprintf(stderr, "aslog-tail: %s: %s\n", optarg, message);
+					exit(2);
+				}
+				__sHasRegex = 1;
+				literal = ASLogTailRegexLiteral(optarg, &length);
+				if (literal != NULL && length > __sPrefilterLength) {
+					__sPrefilter = literal;
+					__sPrefilterLength = length;
+				}
+				break;
+			default:
+				ASLogTailUsage();
+		}
+	}
+	if (optind != argc - 1)
+		ASLogTailUsage();
+
+	// any text every matching line must contain will do, the longest is the rarest
+	if (__sCallSite != NULL && strlen(__sCallSite) > __sPrefilterLength) {
+		__sPrefilter = __sCallSite;
+		__sPrefilterLength = strlen(__sCallSite);
+	}
+	if (__sSourceFile != NULL && strlen(__sSourceFile) > __sPrefilterLength) {
+		__sPrefilter = __sSourceFile;
+		__sPrefilterLength = strlen(__sSourceFile);
+	}
+	if (__sWarningsOnly && sizeof(ASLogTailWarningTag) - 1 > __sPrefilterLength) {
+		__sPrefilter = ASLogTailWarningTag;
+		__sPrefilterLength = sizeof(ASLogTailWarningTag) - 1;
+	}
+
+	ASLogTailFollow(argv[optind], fromStart);
+	return 0;
+}